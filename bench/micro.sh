@@ -0,0 +1,111 @@
+#!/bin/sh
+# Microbenchmarks for the hot paths, reported as one JSON document on stdout so runs from different
+# releases can be kept and compared. Each case runs a script from bench/workload.sh and subtracts
+# the time of the same script without the operation being measured (the load, or the load plus the
+# index build for lookups), taking the best of several runs of each:
+#
+#   delete_rows         column<T>::delete_rows under DELETE ... WHERE key = v without an index
+#   hash_build          GENERATE ... hash INDEX
+#   hash_lookup         quiet PRINT ... WHERE key = v through a hash index
+#   bst_build           GENERATE ... bst INDEX
+#   bst_lookup          quiet PRINT ... WHERE key = v through a bst index
+#   bst_range           quiet PRINT ... WHERE key < v or key > v through a bst index
+#   join_hash           quiet JOIN of two unindexed tables with a key per row (the partitioned hash join)
+#   join_merge          quiet JOIN of two bst indexed tables (the merge join)
+#   mixed               a whole skewed workload of PRINT, DELETE and JOIN over indexed tables
+#
+# Every case runs on an int and a string key column, except mixed, which uses both in one table.
+# JOIN results also carry the plan EXPLAIN reports for them, since the cost model decides it: the
+# merge join needs several rows per key. Run with other row and key counts to see how the costs
+# scale with cardinality, and with SILLY set to compare builds.
+#
+# usage: bench/micro.sh [rows] [distinct keys] [ops] [repeats] > bench.json
+#        (run from the repo root after make release, or use make bench; SILLY picks the binary)
+
+ROWS=${1:-1000000}
+KEYS=${2:-100000}
+OPS=${3:-10000}
+REPEATS=${4:-3}
+SILLY=${SILLY:-./silly}
+WORKLOAD=$(dirname "$0")/workload.sh
+TMP=${TMPDIR:-/tmp}/micro.$$
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+now() { date +%s%N; }
+
+# best of REPEATS runs of silly on a script, in nanoseconds
+best()
+{
+	fastest=
+	i=0
+	while [ $i -lt "$REPEATS" ]; do
+		start=$(now)
+		"$SILLY" -q < "$1" > /dev/null
+		took=$(($(now) - start))
+		[ -z "$fastest" ] || [ "$took" -lt "$fastest" ] && fastest=$took
+		i=$((i + 1))
+	done
+	echo "$fastest"
+}
+
+# the plan EXPLAIN reports for the first JOIN of a script
+plan()
+{
+	case $(sed '/^JOIN/{s/^/EXPLAIN /;q;}' "$1" | "$SILLY" -q | sed -n 's/.*Plan for JOIN of [^:]*: //p') in
+		"hash join"*) echo hash_join ;;
+		merge*) echo merge_join ;;
+		"each row"*) echo index_probe ;;
+		*) echo unknown ;;
+	esac
+}
+
+# measure <name> <key type> <ops> <base workload flags> -- <extra flags for the measured run>
+# prints one JSON result, with the time per op when ops is not 0 and the plan of JOIN cases
+measure()
+{
+	name=$1 type=$2 ops=$3
+	shift 3
+	base=
+	while [ "$1" != -- ]; do
+		base="$base $1"
+		shift
+	done
+	shift
+
+	# shellcheck disable=SC2086
+	"$WORKLOAD" -r "$ROWS" -k "$KEYS" -y "$type,int" $base > "$TMP/base.txt"
+	# shellcheck disable=SC2086
+	"$WORKLOAD" -r "$ROWS" -k "$KEYS" -y "$type,int" $base "$@" > "$TMP/run.txt"
+	elapsed=$(($(best "$TMP/run.txt") - $(best "$TMP/base.txt")))
+	[ $elapsed -lt 0 ] && elapsed=0
+
+	printf '%s    {"name": "%s", "key": "%s", "ops": %d, "ms": %s' "$separator" "$name" "$type" "$ops" \
+		"$(awk -v ns="$elapsed" 'BEGIN { printf "%.3f", ns / 1e6 }')"
+	[ "$ops" -gt 0 ] && printf ', "us_per_op": %s' "$(awk -v ns="$elapsed" -v ops="$ops" 'BEGIN { printf "%.3f", ns / ops / 1e3 }')"
+	grep -q '^JOIN' "$TMP/run.txt" && printf ', "plan": "%s"' "$(plan "$TMP/run.txt")"
+	printf '}'
+	separator=',
+'
+}
+
+# deletes each remove about ROWS / KEYS rows but still rewrite every column, so there are fewer
+DELETES=$((OPS / 100 > 0 ? OPS / 100 : 1))
+JOINS=3
+
+printf '{\n  "commit": "%s",\n  "silly": "%s",\n' "$(git rev-parse --short HEAD 2> /dev/null)" "$SILLY"
+printf '  "rows": %d,\n  "distinct_keys": %d,\n  "repeats": %d,\n  "results": [\n' "$ROWS" "$KEYS" "$REPEATS"
+separator=
+for type in int string; do
+	measure delete_rows "$type" "$DELETES" -- -d "$DELETES"
+	measure hash_build "$type" 0 -- -i hash
+	measure hash_lookup "$type" "$OPS" -i hash -- -p "$OPS"
+	measure bst_build "$type" 0 -- -i bst
+	measure bst_lookup "$type" "$OPS" -i bst -- -p "$OPS"
+	measure bst_range "$type" "$OPS" -i bst -- -p "$OPS" -c '<>'
+	measure join_hash "$type" "$JOINS" -n 2 -k "$ROWS" -- -j "$JOINS"
+	measure join_merge "$type" "$JOINS" -n 2 -i bst -- -j "$JOINS"
+done
+MIXED="-p $OPS -c <=> -d $DELETES -j $JOINS"
+measure mixed string,int,double,bool 0 -n 2 -s 2 -i bst -- $MIXED
+printf '\n  ]\n}\n'
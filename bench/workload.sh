@@ -0,0 +1,121 @@
+#!/bin/sh
+# Writes a synthetic silly script to stdout: CREATE and INSERT for each table, an optional index on
+# the key column, then PRINT, DELETE and JOIN commands shuffled together, and QUIT.
+#
+# Every table has a key column (the first type of -y), an int id column numbering the rows, and one
+# more column for each further type. Keys are drawn from -k distinct values; -s skews them towards
+# the low end by raising the uniform draw to that power, so 1 is uniform and 3 puts about half of
+# all rows on the lowest eighth of the keys. PRINT conditions pick a comparison from -c, DELETEs
+# always match one key, and JOINs pair t1 with t2 on key = key.
+#
+# usage: bench/workload.sh [-r rows] [-k distinct keys] [-s skew] [-y types] [-n tables]
+#                          [-i hash|bst|none] [-p prints] [-c comparisons] [-d deletes] [-j joins]
+#                          [-e seed] > script.txt
+# e.g.   bench/workload.sh -r 1000000 -k 1000 -s 2 -y string,int,double -i bst -p 500 -c '<=>' -d 20
+#        -y takes any of int, double, string and bool; -c takes any of the characters <, = and >.
+
+ROWS=100000
+KEYS=1000
+SKEW=1
+TYPES=int,string,double,bool
+TABLES=1
+INDEX=none
+PRINTS=0
+COMPARISONS='='
+DELETES=0
+JOINS=0
+SEED=281
+
+while getopts r:k:s:y:n:i:p:c:d:j:e: opt; do
+	case $opt in
+		r) ROWS=$OPTARG ;;
+		k) KEYS=$OPTARG ;;
+		s) SKEW=$OPTARG ;;
+		y) TYPES=$OPTARG ;;
+		n) TABLES=$OPTARG ;;
+		i) INDEX=$OPTARG ;;
+		p) PRINTS=$OPTARG ;;
+		c) COMPARISONS=$OPTARG ;;
+		d) DELETES=$OPTARG ;;
+		j) JOINS=$OPTARG ;;
+		e) SEED=$OPTARG ;;
+		*) sed -n '/^# usage/,/^$/p' "$0" >&2; exit 1 ;;
+	esac
+done
+
+[ "$JOINS" -gt 0 ] && [ "$TABLES" -lt 2 ] && TABLES=2
+
+exec awk -v rows="$ROWS" -v keys="$KEYS" -v skew="$SKEW" -v typelist="$TYPES" -v tables="$TABLES" \
+	-v index_type="$INDEX" -v prints="$PRINTS" -v comparisons="$COMPARISONS" -v deletes="$DELETES" \
+	-v joins="$JOINS" -v seed="$SEED" '
+function key() { return int(rand() ^ skew * keys) }
+
+# the literal for value v in a column of type t
+function cell(t, v)
+{
+	if (t == "int")
+		return v;
+	if (t == "double")
+		return v ".5";
+	if (t == "string")
+		return "k" v;
+	return v % 2 ? "true" : "false";
+}
+
+BEGIN {
+	srand(seed);
+	ntypes = split(typelist, types, ",");
+	for (i = 1; i <= ntypes; ++i)
+		if (types[i] != "int" && types[i] != "double" && types[i] != "string" && types[i] != "bool")
+		{
+			print "workload.sh: unknown column type " types[i] > "/dev/stderr";
+			exit 1;
+		}
+	ncomps = split(comparisons, comps, "");
+
+	header = (ntypes + 1) " " types[1] " int";
+	names = "key id";
+	for (i = 2; i <= ntypes; ++i)
+	{
+		header = header " " types[i];
+		names = names " c" i;
+	}
+
+	for (t = 1; t <= tables; ++t)
+	{
+		print "CREATE t" t " " header " " names;
+		print "INSERT INTO t" t " " rows " ROWS";
+		for (r = 0; r < rows; ++r)
+		{
+			line = cell(types[1], key()) " " r;
+			for (i = 2; i <= ntypes; ++i)
+				line = line " " cell(types[i], int(rand() * rows));
+			print line;
+		}
+		if (index_type != "none")
+			print "GENERATE FOR t" t " " index_type " INDEX ON key";
+	}
+
+	# deal the commands out in random order, each kind in proportion to what is left of it
+	for (left = prints + deletes + joins; left > 0; --left)
+	{
+		pick = rand() * left;
+		t = "t" (1 + int(rand() * tables));
+		if (pick < prints)
+		{
+			--prints;
+			print "PRINT FROM " t " 1 id WHERE key " comps[1 + int(rand() * ncomps)] " " cell(types[1], key());
+		}
+		else if (pick < prints + deletes)
+		{
+			--deletes;
+			print "DELETE FROM " t " WHERE key = " cell(types[1], key());
+		}
+		else
+		{
+			--joins;
+			print "JOIN t1 AND t2 WHERE key = key AND PRINT 2 id 1 id 2";
+		}
+	}
+	print "QUIT";
+}'
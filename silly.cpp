@@ -10,16 +10,49 @@
 #include <getopt.h>
 #include <limits>
 #include <variant>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <iomanip>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 class tableOptions
 {
 public:
 	tableOptions(int argc, char *argv[])
 	{
-		const char *short_opts = "hq";
+		const char *short_opts = "hqspt:d:w:c:";
 		const option long_opts[] = {
 			{"help", no_argument, nullptr, 'h'},
 			{"quiet", no_argument, nullptr, 'q'},
+			{"stats", no_argument, nullptr, 's'},
+			{"pipeline", no_argument, nullptr, 'p'},
+			{"threads", required_argument, nullptr, 't'},
+			{"lazy-delete", required_argument, nullptr, 'd'},
+			{"wal", required_argument, nullptr, 'w'},
+			{"cache", required_argument, nullptr, 'c'},
 			{nullptr, 0, nullptr, 0}};
 
 		int opt;
@@ -34,6 +67,29 @@ public:
 			case 'q':
 				quiet = true;
 				break;
+			case 's':
+				stats = true;
+				break;
+			case 'p':
+				pipeline = true;
+				break;
+			case 't':
+				threads = parseCount(optarg, "--threads");
+				if (threads == 0)
+					threads = std::max(1u, std::thread::hardware_concurrency());
+				break;
+			case 'd':
+				compact_at = parseFraction(optarg, "--lazy-delete");
+				break;
+			case 'w':
+				wal_path = optarg;
+				break;
+			case 'c':
+				cache_bytes = parseCount(optarg, "--cache");
+				if (cache_bytes > std::numeric_limits<std::size_t>::max() >> 20)
+					usageError("--cache", optarg);
+				cache_bytes <<= 20;
+				break;
 			default:
 				break;
 			}
@@ -46,701 +102,5711 @@ public:
 		return quiet;
 	}
 
-private:
-	// print help message
-	void printHelp() const
+	bool keepStats() const
 	{
-		std::cout << "Usage: silly [options]\n"
-				  << "-h, --help\t\tPrint this help message and exit.\n"
-				  << "-q, --quiet\t\tRun in quiet mode.\n";
+		return stats;
 	}
 
-	// quiet mode
-	bool quiet = false;
-};
-
-template <typename T>
-int compare_3way(T a, T b)
-{
-	if (a < b)
-		return -1;
-	if (a > b)
-		return 1;
-	return 0;
-}
-
-template <>
-int compare_3way(const std::string &a, const std::string &b) { return a.compare(b); }
-
-template <typename T>
-T from_string(const std::string &str);
-
-template <>
-bool from_string(const std::string &str) { return str == "true"; }
-
-template <>
-std::string from_string(const std::string &str) { return str; }
-
-template <>
-int from_string(const std::string &str) { return std::stoi(str); }
-
-template <>
-double from_string(const std::string &str) { return std::stod(str); }
+	bool isPipelined() const
+	{
+		return pipeline;
+	}
 
-enum class compare_t : int
-{
-	greater = 1,
-	less = -1,
-	equals = 0,
-};
+	std::size_t numThreads() const
+	{
+		return threads;
+	}
 
-enum class index_type : bool
-{
-	bst,
-	hash,
-};
+	double compactAt() const
+	{
+		return compact_at;
+	}
 
-class index_base;
+	const std::string &walPath() const
+	{
+		return wal_path;
+	}
 
-class column_base
-{
-public:
-	column_base(std::string_view _name) : name{_name} {}
-	std::string name;
+	std::size_t cacheBytes() const
+	{
+		return cache_bytes;
+	}
 
-	virtual void print(std::size_t row) const = 0;
+private:
+	// a whole non-negative decimal number, or a usage error naming the option
+	static std::size_t parseCount(const char *arg, const char *option)
+	{
+		const char *end = arg + std::strlen(arg);
+		std::size_t value = 0;
+		auto [ptr, ec] = std::from_chars(arg, end, value);
+		if (ec != std::errc{} || ptr != end || arg == end)
+			usageError(option, arg);
+		return value;
+	}
 
-	virtual int compare(std::size_t row, const void *value) const = 0;
-	// rows must be sorted
-	virtual void delete_rows(const std::vector<std::size_t> &rows) = 0;
+	// a number in (0, 1], or a usage error naming the option
+	static double parseFraction(const char *arg, const char *option)
+	{
+		const char *end = arg + std::strlen(arg);
+		double value = 0;
+		auto [ptr, ec] = std::from_chars(arg, end, value);
+		if (ec != std::errc{} || ptr != end || !(value > 0 && value <= 1))
+			usageError(option, arg);
+		return value;
+	}
 
-	virtual index_base *generate_index(index_type type) = 0;
+	[[noreturn]] static void usageError(const char *option, const char *arg)
+	{
+		std::cerr << "silly: invalid value '" << arg << "' for " << option
+				  << "\nTry 'silly --help' for more information.\n";
+		exit(1);
+	}
 
-	// won't be dynamically allocated
-	virtual void *buff_from_str(const std::string &str) const = 0;
-	// won't be dynamically allocated
-	virtual void *buff_from_row(std::size_t row) const = 0;
+	// print help message
+	void printHelp() const
+	{
+		std::cout << "Usage: silly [options]\n"
+				  << "-h, --help\t\tPrint this help message and exit.\n"
+				  << "-q, --quiet\t\tRun in quiet mode.\n"
+				  << "-s, --stats\t\tTime each command and count the rows it scanned, its index\n"
+				  << "\t\t\tlookups and rebuilds and the bytes it printed, and sum\n"
+				  << "\t\t\tthem up per command on stderr at QUIT.\n"
+				  << "-p, --pipeline\t\tRead input ahead and write output behind on their own\n"
+				  << "\t\t\tthreads while commands run; the output stays the same.\n"
+				  << "-t, --threads N\t\tScan tables with N threads, 0 for one per core.\n"
+				  << "-d, --lazy-delete F\tOnly mark deleted rows, compact a table once more than\n"
+				  << "\t\t\tfraction F of its rows are marked.\n"
+				  << "-w, --wal FILE\t\tLog changes to FILE and replay it on startup, CHECKPOINT\n"
+				  << "\t\t\tsnapshots the tables next to it and restarts the log.\n"
+				  << "-c, --cache MB\t\tKeep up to MB megabytes of PRINT ... WHERE and JOIN results\n"
+				  << "\t\t\tand answer repeats from them until a table changes.\n";
+	}
 
-	virtual void push_back(const void *value) = 0;
-	virtual std::size_t size() const = 0;
-	virtual ~column_base() = default;
+	// quiet mode
+	bool quiet = false;
+	// per command timings and counters
+	bool stats = false;
+	// input and output on their own threads
+	bool pipeline = false;
+	// threads used for table scans
+	std::size_t threads = 1;
+	// fraction of dead rows that makes DELETE compact a table, 0 deletes rows right away
+	double compact_at = 0;
+	// write-ahead log, none if empty
+	std::string wal_path;
+	// result cache budget, no cache if 0
+	std::size_t cache_bytes = 0;
 };
 
+// hands items from one thread to another in order; push waits while the queue is full and pop
+// while it is empty, until close(), after which push drops items and pop drains what is left
 template <typename T>
-class column : public column_base
+class bounded_queue
 {
 public:
-	column(std::string_view name) : column_base(name) {}
+	explicit bounded_queue(std::size_t capacity) : capacity{capacity} {}
 
-	void print(std::size_t row) const override { std::cout << data[row]; }
-
-	int compare(std::size_t row, const void *value) const override { return compare_3way(data[row], *reinterpret_cast<const T *>(value)); }
-	void delete_rows(const std::vector<std::size_t> &rows) override
+	bool push(T item)
 	{
-		if (rows.empty())
-			return;
-		
-		std::size_t cur_index = 0;
-		auto it = rows.begin();
-		for (std::size_t i = 0; i < data.size(); ++i)
-		{
-			if (it == rows.end())
-				data[cur_index++] = data[i];
-			else
-			{
-				if (*it != i)
-					data[cur_index++] = data[i];
-				else
-					++it;
-			}
-		}
-
-		data.erase(data.begin() + cur_index, data.end());
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+		if (closed)
+			return false;
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+		return true;
 	}
 
-	index_base *generate_index(index_type type) override;
+	// false once the queue is closed and empty
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+		return take(item);
+	}
 
-	void *buff_from_str(const std::string &str) const override
+	// pop without waiting, false if nothing is queued
+	bool try_pop(T &item)
 	{
-		buffer = from_string<T>(str);
-		return &buffer;
+		std::lock_guard<std::mutex> lock(mutex);
+		return take(item);
 	}
-	void *buff_from_row(std::size_t row) const override
+
+	void close()
 	{
-		buffer = data[row];
-		return &buffer;
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_full.notify_all();
+		not_empty.notify_all();
 	}
 
-	void push_back(const void *value) override { data.push_back(*reinterpret_cast<const T *>(value)); }
-	std::size_t size() const override { return data.size(); }
+private:
+	bool take(T &item)
+	{
+		if (items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
 
-	std::vector<T> data;
-	mutable T buffer;
+	std::size_t capacity;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable not_full, not_empty;
+	bool closed = false;
 };
 
-class index_base
+// the output stage of --pipeline: installed as the stream's buffer, it collects the text in large
+// blocks that a writer thread writes out while the next commands run. A flush waits for everything
+// so far to be written, so whatever flushed std::cout before (prompts before blocking on input,
+// the terminate handler) still sees its output out
+class piped_output : public std::streambuf
 {
 public:
-	index_base(column_base *owner) : ref{owner} {}
-
-	virtual void update(bool do_update) = 0;
-	virtual void push_back(const void *value) = 0;
-	virtual std::size_t distinct() const = 0;
+	piped_output(std::ostream &os, int fd) : os{os}, fd{fd}, writer{[this]() { write_blocks(); }}
+	{
+		block.reserve(block_size);
+		previous = os.rdbuf(this);
+	}
 
-	virtual void do_on_matching_rows(const void *value, compare_t comp, std::function<void(std::size_t)> func) = 0;
-	// don't use with multithreading, may return static data
-	// for use with delete_rows, returns sorted indices
-	virtual const std::vector<std::size_t> &get_matching_rows(const void *value, compare_t comp) = 0;
+	piped_output(const piped_output &) = delete;
+	piped_output &operator=(const piped_output &) = delete;
 
-	virtual ~index_base() = default;
+	~piped_output()
+	{
+		hand_over();
+		blocks.close();
+		writer.join();
+		os.rdbuf(previous);
+	}
 
-	column_base *ref;
-};
+protected:
+	int_type overflow(int_type c) override
+	{
+		if (traits_type::eq_int_type(c, traits_type::eof()))
+			return traits_type::not_eof(c);
+		block.push_back(traits_type::to_char_type(c));
+		if (block.size() >= block_size)
+			hand_over();
+		return c;
+	}
 
-template <typename T>
-class hash_index : public index_base
-{
-public:
-	hash_index(column_base *owner) : index_base(owner), needs_to_update{false}
+	std::streamsize xsputn(const char *s, std::streamsize n) override
 	{
-		update_map();
+		block.insert(block.end(), s, s + n);
+		if (block.size() >= block_size)
+			hand_over();
+		return n;
 	}
 
-	void update(bool do_update) override
+	int sync() override
 	{
-		needs_to_update = do_update;
+		hand_over();
+		std::unique_lock<std::mutex> lock(mutex);
+		written.wait(lock, [this]() { return pending == 0; });
+		return failed ? -1 : 0;
 	}
 
-	void push_back(const void *value) override
+private:
+	static constexpr std::size_t block_size = 1 << 18;
+
+	void hand_over()
 	{
-		if (needs_to_update)
+		if (block.empty())
+			return;
 		{
-			update_map();
-			needs_to_update = false;
+			std::lock_guard<std::mutex> lock(mutex);
+			++pending;
 		}
-
-		auto interpreted_ref = dynamic_cast<column<T> *>(ref);
-
-		auto &data = *reinterpret_cast<const T *>(value);
-		map[data].push_back(interpreted_ref->size());
-		interpreted_ref->data.push_back(data);
+		blocks.push(std::move(block));
+		block = {};
+		block.reserve(block_size);
 	}
 
-	std::size_t distinct() const override { return map.size(); }
-
-	void do_on_matching_rows(const void *value, compare_t comp, std::function<void(std::size_t)> func) override
+	void write_blocks()
 	{
-		if (comp == compare_t::equals)
+		std::vector<char> out;
+		while (blocks.pop(out))
 		{
-			if (needs_to_update)
+			for (std::size_t done = 0; done < out.size() && !failed;)
 			{
-				update_map();
-				needs_to_update = false;
+				ssize_t n = ::write(fd, out.data() + done, out.size() - done);
+				if (n >= 0)
+					done += static_cast<std::size_t>(n);
+				else if (errno != EINTR)
+					failed = true;
 			}
 
-			auto it = map.find(*reinterpret_cast<const T *>(value));
-			if (it != map.end())
-				for (auto i : it->second)
-					func(i);
-		}
-		else
-		{
-			for (std::size_t i = 0; i < ref->size(); ++i)
-				if (ref->compare(i, value) == static_cast<int>(comp))
-					func(i);
+			std::lock_guard<std::mutex> lock(mutex);
+			--pending;
+			written.notify_all();
 		}
 	}
 
-	const std::vector<std::size_t> &get_matching_rows(const void *value, compare_t comp) override
+	std::ostream &os;
+	std::streambuf *previous;
+	int fd;
+	std::vector<char> block;
+	// a few blocks in flight are enough to keep the writer busy
+	bounded_queue<std::vector<char>> blocks{4};
+	std::mutex mutex;
+	std::condition_variable written;
+	std::size_t pending = 0;
+	std::atomic<bool> failed{false};
+	std::thread writer;
+};
+
+// whitespace separated token source for the command loop, a zero-copy stand-in for std::cin >> str
+// regular files are mapped whole, anything else (pipes, terminals) is read in large chunks, by a
+// thread of its own with read_ahead, so the next commands arrive while the current one runs
+class command_reader
+{
+public:
+	// before_wait runs before every read that may block, the way std::cin flushes its tied stream
+	command_reader(int fd, std::function<void()> before_wait = {}, bool read_ahead = false) : m_fd{fd}, m_before_wait{std::move(before_wait)}
 	{
-		static std::vector<std::size_t> buffer;
-		buffer.clear();
-		if (comp == compare_t::equals)
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
 		{
-			if (needs_to_update)
+			void *map = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED)
 			{
-				update_map();
-				needs_to_update = false;
+				madvise(map, static_cast<std::size_t>(st.st_size), MADV_SEQUENTIAL);
+				m_data = static_cast<const char *>(map);
+				m_end = static_cast<std::size_t>(st.st_size);
+				m_mapped = true;
+				return;
 			}
-
-			auto it = map.find(*reinterpret_cast<const T *>(value));
-			if (it != map.end())
-				return it->second;
-			else
-				return buffer;
 		}
-		else
+
+		m_buffer.resize(chunk_size);
+		m_data = m_buffer.data();
+
+		if (read_ahead)
 		{
-			buffer.reserve(ref->size());
-			for (std::size_t i = 0; i < ref->size(); ++i)
-				if (ref->compare(i, value) == static_cast<int>(comp))
-					buffer.push_back(i);
-			
-			return buffer;
+			// the reader may sit in read() on a terminal long after QUIT, so it's left to run
+			// out with the process and shares the queue with it
+			m_chunks = std::make_shared<bounded_queue<std::vector<char>>>(4);
+			std::thread([fd, chunks = m_chunks]()
+						{
+							for (;;)
+							{
+								std::vector<char> chunk(chunk_size);
+								ssize_t n = read_some(fd, chunk.data(), chunk.size());
+								if (n <= 0)
+									break;
+								chunk.resize(static_cast<std::size_t>(n));
+								if (!chunks->push(std::move(chunk)))
+									break;
+							}
+							chunks->close(); })
+				.detach();
 		}
 	}
 
-private:
-	std::unordered_map<T, std::vector<std::size_t>> map;
-	bool needs_to_update;
+	command_reader(const command_reader &) = delete;
+	command_reader &operator=(const command_reader &) = delete;
 
-	void update_map()
+	~command_reader()
 	{
-		auto interpreted_ref = dynamic_cast<column<T> *>(ref);
-		map.clear();
-		map.reserve(interpreted_ref->data.size());
-		for (std::size_t i = 0; i < interpreted_ref->data.size(); ++i)
-			map[interpreted_ref->data[i]].push_back(i);
+		if (m_mapped)
+			munmap(const_cast<char *>(m_data), m_end);
+		if (m_chunks)
+			m_chunks->close();
 	}
-};
 
-template <typename T>
-class bst_index : public index_base
-{
-public:
-	bst_index(column_base *owner) : index_base(owner), needs_to_update{false}
-	{
-		update_map();
-	}
+	// like std::cin, false once a read ran past the end of input or a number failed to parse,
+	// every read after that comes back empty
+	explicit operator bool() const { return !m_failed; }
 
-	void update(bool do_update) override
+	// the view stays valid until the next read
+	std::string_view token()
 	{
-		needs_to_update = do_update;
+		std::size_t keep = npos;
+		auto [begin, len] = scan(keep);
+		return {m_data + (begin - m_base), len};
 	}
 
-	void push_back(const void *value) override
+	// reads n tokens at once, all views stay valid until the next read
+	void tokens(std::size_t n, std::vector<std::string_view> &out)
 	{
-		if (needs_to_update)
+		m_spans.resize(n);
+
+		std::size_t keep = m_base + m_pos;
+		for (std::size_t i = 0; i < n; ++i)
 		{
-			update_map();
-			needs_to_update = false;
+			auto [begin, len] = scan(keep);
+			m_spans[i] = {begin - keep, len};
 		}
 
-		auto interpreted_ref = dynamic_cast<column<T> *>(ref);
-
-		auto &data = *reinterpret_cast<const T *>(value);
-		map[data].push_back(interpreted_ref->size());
-		interpreted_ref->data.push_back(data);
+		out.resize(n);
+		for (std::size_t i = 0; i < n; ++i)
+			out[i] = {m_data + (keep - m_base) + m_spans[i].first, m_spans[i].second};
 	}
 
-	std::size_t distinct() const override { return map.size(); }
-
-	void do_on_matching_rows(const void *value, compare_t comp, std::function<void(std::size_t)> func) override
+	// next non-whitespace character, '\0' at end of input
+	char character()
 	{
-		if (needs_to_update)
+		std::size_t keep = npos;
+		if (m_failed || !skip_whitespace(keep))
 		{
-			update_map();
-			needs_to_update = false;
+			m_failed = true;
+			return '\0';
 		}
+		return m_data[m_pos++];
+	}
 
-		if (comp == compare_t::equals)
+	template <typename T>
+	void read(T &value)
+	{
+		auto str = token();
+		auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+		if (ec != std::errc{})
 		{
-			auto it = map.find(*reinterpret_cast<const T *>(value));
-			if (it != map.end())
-				for (auto i : it->second)
-					func(i);
+			value = T{};
+			m_failed = true;
 		}
-		else if (comp == compare_t::greater)
+	}
+
+	// consumes the next token if it is word and still on the current line, so a command's optional
+	// words never wait for the next line to arrive
+	bool accept(std::string_view word)
+	{
+		if (m_failed)
+			return false;
+
+		std::size_t start = m_base + m_pos;
+		do
 		{
-			auto it = map.upper_bound(*reinterpret_cast<const T *>(value));
-			for (; it != map.end(); ++it)
-				for (auto i : it->second)
-					func(i);
-		}
-		else
+			while (m_pos < m_end && (m_data[m_pos] == ' ' || m_data[m_pos] == '\t'))
+				++m_pos;
+			if (m_pos < m_end)
+				break;
+		} while (fill(start));
+
+		if (m_pos < m_end && !is_space(m_data[m_pos]))
 		{
-			for (auto &v : map)
-				for (auto i : v.second)
-					if (ref->compare(i, value) == static_cast<int>(comp))
-						func(i);
+			auto [begin, len] = scan(start);
+			if (std::string_view(m_data + (begin - m_base), len) == word)
+				return true;
 		}
+		m_pos = start - m_base;
+		return false;
 	}
 
-	const std::vector<std::size_t> &get_matching_rows(const void *value, compare_t comp) override
+	// skips through the end of the current line
+	void ignore_line()
 	{
-		static std::vector<std::size_t> buffer;
-		buffer.clear();
-		if (comp == compare_t::equals)
-		{
-			if (needs_to_update)
-			{
-				update_map();
-				needs_to_update = false;
-			}
+		if (m_failed)
+			return;
 
-			auto it = map.find(*reinterpret_cast<const T *>(value));
-			if (it != map.end())
-				return it->second;
-			else
-				return buffer;
-		}
-		else if (comp == compare_t::greater)
+		do
 		{
-			if (needs_to_update)
+			auto nl = static_cast<const char *>(std::memchr(m_data + m_pos, '\n', m_end - m_pos));
+			if (nl)
 			{
-				update_map();
-				needs_to_update = false;
+				m_pos = static_cast<std::size_t>(nl - m_data) + 1;
+				return;
 			}
+			m_pos = m_end;
+		} while (fill(m_base + m_pos));
+	}
 
-			auto it = map.upper_bound(*reinterpret_cast<const T *>(value));
-			for (; it != map.end(); ++it)
-			{
-				if (it->second.size() + buffer.size() > buffer.capacity())
-					buffer.reserve(buffer.size() + it->second.size());
-				buffer.insert(buffer.end(), it->second.begin(), it->second.end());
-			}
+private:
+	static constexpr std::size_t chunk_size = 1 << 20;
+	static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
 
-			std::sort(buffer.begin(), buffer.end());
+	static bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
 
-			return buffer;
-		}
-		else
+	// keep is an absolute input offset, bytes from there on survive refills
+	bool skip_whitespace(std::size_t keep)
+	{
+		do
 		{
-			buffer.reserve(ref->size());
-			for (std::size_t i = 0; i < ref->size(); ++i)
-				if (ref->compare(i, value) == static_cast<int>(comp))
-					buffer.push_back(i);
+			while (m_pos < m_end && is_space(m_data[m_pos]))
+				++m_pos;
+			if (m_pos < m_end)
+				return true;
+		} while (fill(std::min(keep, m_base + m_pos)));
+		return false;
+	}
 
-			return buffer;
+	// returns absolute offset and length of the next token
+	std::pair<std::size_t, std::size_t> scan(std::size_t keep)
+	{
+		if (m_failed || !skip_whitespace(keep))
+		{
+			m_failed = true;
+			return {m_base + m_pos, 0};
 		}
+
+		std::size_t begin = m_base + m_pos;
+		do
+		{
+			while (m_pos < m_end && !is_space(m_data[m_pos]))
+				++m_pos;
+			if (m_pos < m_end)
+				break;
+		} while (fill(std::min(keep, begin)));
+
+		return {begin, m_base + m_pos - begin};
 	}
 
-private:
-	std::map<T, std::vector<std::size_t>> map;
-	bool needs_to_update;
+	static ssize_t read_some(int fd, char *buf, std::size_t n)
+	{
+		ssize_t got;
+		do
+			got = ::read(fd, buf, n);
+		while (got < 0 && errno == EINTR);
+		return got;
+	}
 
-	void update_map()
+	// drops the input before absolute offset from and reads more behind what is left,
+	// false at end of input
+	bool fill(std::size_t from)
 	{
-		auto interpreted_ref = dynamic_cast<column<T> *>(ref);
-		map.clear();
-		for (std::size_t i = 0; i < interpreted_ref->data.size(); ++i)
-			map[interpreted_ref->data[i]].push_back(i);
+		if (m_mapped || m_eof)
+			return false;
+
+		// read ahead only has to wait when the reader hasn't got the next chunk yet
+		std::vector<char> chunk;
+		bool ready = m_chunks && m_chunks->try_pop(chunk);
+		if (!ready && m_before_wait)
+			m_before_wait();
+
+		std::size_t shift = from - m_base;
+		std::memmove(m_buffer.data(), m_buffer.data() + shift, m_end - shift);
+		m_base = from;
+		m_end -= shift;
+		m_pos -= shift;
+		if (m_chunks)
+		{
+			if (!ready && !m_chunks->pop(chunk))
+			{
+				m_eof = true;
+				return false;
+			}
+			if (m_buffer.size() < m_end + chunk.size())
+				m_buffer.resize(std::max(m_buffer.size() * 2, m_end + chunk.size()));
+			std::memcpy(m_buffer.data() + m_end, chunk.data(), chunk.size());
+			m_data = m_buffer.data();
+			m_end += chunk.size();
+			return true;
+		}
+
+		if (m_end == m_buffer.size())
+			m_buffer.resize(m_buffer.size() * 2);
+		m_data = m_buffer.data();
+
+		ssize_t n = read_some(m_fd, m_buffer.data() + m_end, m_buffer.size() - m_end);
+		if (n <= 0)
+		{
+			m_eof = true;
+			return false;
+		}
+
+		m_end += static_cast<std::size_t>(n);
+		return true;
 	}
+
+	int m_fd;
+	std::function<void()> m_before_wait;
+	const char *m_data = nullptr;
+	// m_pos and m_end index into m_data, which starts at absolute input offset m_base
+	std::size_t m_base = 0, m_pos = 0, m_end = 0;
+	std::vector<char> m_buffer;
+	std::vector<std::pair<std::size_t, std::size_t>> m_spans;
+	// chunks from the read ahead thread, if there is one
+	std::shared_ptr<bounded_queue<std::vector<char>>> m_chunks;
+	bool m_mapped = false, m_eof = false, m_failed = false;
 };
 
+// -1, 0 or 1, and 2 for a NaN, which matches no compare_t
 template <typename T>
-index_base *column<T>::generate_index(index_type type)
+int compare_3way(T a, T b)
 {
-	if (type == index_type::bst)
-	{
-		auto res = new bst_index<T>(this);
-		return res;
+	if (a < b)
+		return -1;
+	if (a > b)
+		return 1;
+	return a == b ? 0 : 2;
+}
+
+inline int compare_3way(std::string_view a, std::string_view b)
+{
+	int res = a.compare(b);
+	return (res > 0) - (res < 0);
+}
+
+// parses a numeric token in place, accepting a leading '+' and trailing junk like stoi/stod do
+template <typename T, typename... Args>
+T parse_number(std::string_view str, const char *what, Args... args)
+{
+	const char *first = str.data(), *last = str.data() + str.size();
+	if (first != last && *first == '+')
+		++first;
+
+	T res{};
+	auto [ptr, ec] = std::from_chars(first, last, res, args...);
+	if (ec == std::errc::invalid_argument)
+		throw std::invalid_argument(what);
+	if (ec == std::errc::result_out_of_range)
+		throw std::out_of_range(what);
+	return res;
+}
+
+template <typename T>
+T from_string(std::string_view str);
+
+template <>
+bool from_string(std::string_view str) { return str == "true"; }
+
+template <>
+std::string from_string(std::string_view str) { return std::string(str); }
+
+template <>
+int from_string(std::string_view str) { return parse_number<int>(str, "stoi"); }
+
+template <>
+double from_string(std::string_view str) { return parse_number<double>(str, "stod", std::chars_format::general); }
+
+enum class compare_t : int
+{
+	greater = 1,
+	less = -1,
+	equals = 0,
+};
+
+enum class index_type : bool
+{
+	bst,
+	hash,
+};
+
+// x compared to v the way compare_3way(x, v) == comp would, NaNs match nothing
+template <compare_t C, typename X, typename V>
+inline bool matches(const X &x, const V &v)
+{
+	if constexpr (C == compare_t::less)
+		return x < v;
+	else if constexpr (C == compare_t::greater)
+		return v < x;
+	else
+		return x == v;
+}
+
+// predicate kernels over a plain array: count returns the number of matches in data[0, N), select
+// writes the matching positions in [first, last) to out and returns how many it wrote
+template <typename T, compare_t C>
+std::size_t count_scalar(const T *data, std::size_t N, T value)
+{
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < N; ++i)
+		n += matches<C>(data[i], value);
+	return n;
+}
+
+template <typename T, compare_t C>
+std::size_t select_scalar(const T *data, std::size_t first, std::size_t last, T value, std::size_t *out)
+{
+	std::size_t n = 0;
+	for (std::size_t i = first; i < last; ++i)
+	{
+		out[n] = i;
+		n += matches<C>(data[i], value);
+	}
+	return n;
+}
+
+std::size_t popcount_scalar(const std::uint64_t *words, std::size_t N)
+{
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < N; ++i)
+		n += static_cast<std::size_t>(__builtin_popcountll(words[i]));
+	return n;
+}
+
+#if defined(__x86_64__)
+// one bit per lane of the comparison, SSE2 is always there on x86-64
+template <compare_t C>
+inline unsigned lanes_sse2(const int *p, __m128i v)
+{
+	__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), m;
+	if constexpr (C == compare_t::less)
+		m = _mm_cmplt_epi32(x, v);
+	else if constexpr (C == compare_t::greater)
+		m = _mm_cmpgt_epi32(x, v);
+	else
+		m = _mm_cmpeq_epi32(x, v);
+	return static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(m)));
+}
+
+template <compare_t C>
+inline unsigned lanes_sse2(const double *p, __m128d v)
+{
+	__m128d x = _mm_loadu_pd(p), m;
+	if constexpr (C == compare_t::less)
+		m = _mm_cmplt_pd(x, v);
+	else if constexpr (C == compare_t::greater)
+		m = _mm_cmpgt_pd(x, v);
+	else
+		m = _mm_cmpeq_pd(x, v);
+	return static_cast<unsigned>(_mm_movemask_pd(m));
+}
+
+inline __m128i splat_sse2(int v) { return _mm_set1_epi32(v); }
+inline __m128d splat_sse2(double v) { return _mm_set1_pd(v); }
+
+template <typename T, compare_t C>
+std::size_t count_sse2(const T *data, std::size_t N, T value)
+{
+	constexpr std::size_t W = 16 / sizeof(T);
+	auto v = splat_sse2(value);
+	std::size_t n = 0, i = 0;
+	for (; i + W <= N; i += W)
+		n += static_cast<std::size_t>(__builtin_popcount(lanes_sse2<C>(data + i, v)));
+	return n + count_scalar<T, C>(data + i, N - i, value);
+}
+
+template <typename T, compare_t C>
+std::size_t select_sse2(const T *data, std::size_t first, std::size_t last, T value, std::size_t *out)
+{
+	constexpr std::size_t W = 16 / sizeof(T);
+	auto v = splat_sse2(value);
+	std::size_t n = 0, i = first;
+	for (; i + W <= last; i += W)
+		for (unsigned m = lanes_sse2<C>(data + i, v); m; m &= m - 1)
+			out[n++] = i + static_cast<std::size_t>(__builtin_ctz(m));
+	for (; i < last; ++i)
+	{
+		out[n] = i;
+		n += matches<C>(data[i], value);
+	}
+	return n;
+}
+
+template <compare_t C>
+__attribute__((target("avx2"))) inline unsigned lanes_avx2(const int *p, __m256i v)
+{
+	__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)), m;
+	if constexpr (C == compare_t::less)
+		m = _mm256_cmpgt_epi32(v, x);
+	else if constexpr (C == compare_t::greater)
+		m = _mm256_cmpgt_epi32(x, v);
+	else
+		m = _mm256_cmpeq_epi32(x, v);
+	return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+}
+
+template <compare_t C>
+__attribute__((target("avx2"))) inline unsigned lanes_avx2(const double *p, __m256d v)
+{
+	__m256d x = _mm256_loadu_pd(p), m;
+	if constexpr (C == compare_t::less)
+		m = _mm256_cmp_pd(x, v, _CMP_LT_OQ);
+	else if constexpr (C == compare_t::greater)
+		m = _mm256_cmp_pd(x, v, _CMP_GT_OQ);
+	else
+		m = _mm256_cmp_pd(x, v, _CMP_EQ_OQ);
+	return static_cast<unsigned>(_mm256_movemask_pd(m));
+}
+
+__attribute__((target("avx2"))) inline __m256i splat_avx2(int v) { return _mm256_set1_epi32(v); }
+__attribute__((target("avx2"))) inline __m256d splat_avx2(double v) { return _mm256_set1_pd(v); }
+
+template <typename T, compare_t C>
+__attribute__((target("avx2,popcnt,bmi"))) std::size_t count_avx2(const T *data, std::size_t N, T value)
+{
+	constexpr std::size_t W = 32 / sizeof(T);
+	auto v = splat_avx2(value);
+	std::size_t n = 0, i = 0;
+	for (; i + W <= N; i += W)
+		n += static_cast<std::size_t>(__builtin_popcount(lanes_avx2<C>(data + i, v)));
+	for (; i < N; ++i)
+		n += matches<C>(data[i], value);
+	return n;
+}
+
+template <typename T, compare_t C>
+__attribute__((target("avx2,popcnt,bmi"))) std::size_t select_avx2(const T *data, std::size_t first, std::size_t last, T value, std::size_t *out)
+{
+	constexpr std::size_t W = 32 / sizeof(T);
+	auto v = splat_avx2(value);
+	std::size_t n = 0, i = first;
+	for (; i + W <= last; i += W)
+		for (unsigned m = lanes_avx2<C>(data + i, v); m; m &= m - 1)
+			out[n++] = i + static_cast<std::size_t>(__builtin_ctz(m));
+	for (; i < last; ++i)
+	{
+		out[n] = i;
+		n += matches<C>(data[i], value);
+	}
+	return n;
+}
+
+__attribute__((target("popcnt"))) std::size_t popcount_hw(const std::uint64_t *words, std::size_t N)
+{
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < N; ++i)
+		n += static_cast<std::size_t>(__builtin_popcountll(words[i]));
+	return n;
+}
+#endif
+
+// the scan kernels for int and double columns, picked once by what the CPU supports
+template <typename T>
+struct scan_kernels
+{
+	using count_fn = std::size_t (*)(const T *, std::size_t, T);
+	using select_fn = std::size_t (*)(const T *, std::size_t, std::size_t, T, std::size_t *);
+
+	// indexed by static_cast<int>(comp) + 1
+	count_fn count[3];
+	select_fn select[3];
+
+	static const scan_kernels &get()
+	{
+		static const scan_kernels res = []() -> scan_kernels
+		{
+#if defined(__x86_64__)
+			if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("bmi"))
+				return {{count_avx2<T, compare_t::less>, count_avx2<T, compare_t::equals>, count_avx2<T, compare_t::greater>},
+						{select_avx2<T, compare_t::less>, select_avx2<T, compare_t::equals>, select_avx2<T, compare_t::greater>}};
+			return {{count_sse2<T, compare_t::less>, count_sse2<T, compare_t::equals>, count_sse2<T, compare_t::greater>},
+					{select_sse2<T, compare_t::less>, select_sse2<T, compare_t::equals>, select_sse2<T, compare_t::greater>}};
+#else
+			return {{count_scalar<T, compare_t::less>, count_scalar<T, compare_t::equals>, count_scalar<T, compare_t::greater>},
+					{select_scalar<T, compare_t::less>, select_scalar<T, compare_t::equals>, select_scalar<T, compare_t::greater>}};
+#endif
+		}();
+		return res;
+	}
+
+	std::size_t count_matching(const T *data, std::size_t first, std::size_t last, T value, compare_t comp) const
+	{
+		return count[static_cast<int>(comp) + 1](data + first, last - first, value);
+	}
+
+	std::size_t select_matching(const T *data, std::size_t first, std::size_t last, T value, compare_t comp, std::size_t *out) const
+	{
+		return select[static_cast<int>(comp) + 1](data, first, last, value, out);
+	}
+};
+
+// number of set bits over all words
+inline std::size_t popcount_words(const std::uint64_t *words, std::size_t N)
+{
+#if defined(__x86_64__)
+	static const auto fn = __builtin_cpu_supports("popcnt") ? popcount_hw : popcount_scalar;
+	return fn(words, N);
+#else
+	return popcount_scalar(words, N);
+#endif
+}
+
+// a bool compared to value matches exactly when it equals target, false if nothing can match
+inline bool bit_target(bool value, compare_t comp, bool &target)
+{
+	if (comp == compare_t::equals)
+		target = value;
+	else if (comp == compare_t::less) // only false < true
+		target = false;
+	else
+		target = true;
+	return comp == compare_t::equals || value != target;
+}
+
+class index_base;
+
+// removes the given rows (sorted) from data, keeping the order of the rest
+template <typename V>
+void erase_rows(V &data, const std::vector<std::size_t> &rows)
+{
+	if (rows.empty())
+		return;
+
+	std::size_t cur_index = 0;
+	auto it = rows.begin();
+	for (std::size_t i = 0; i < data.size(); ++i)
+	{
+		if (it == rows.end())
+			data[cur_index++] = data[i];
+		else
+		{
+			if (*it != i)
+				data[cur_index++] = data[i];
+			else
+				++it;
+		}
+	}
+
+	data.erase(data.begin() + static_cast<std::ptrdiff_t>(cur_index), data.end());
+}
+
+// SAVE files: a header, then each column's data as raw segments in native byte order, every segment
+// starting 64-byte aligned so it can be read straight out of a mapping of the file
+constexpr char snapshot_magic[8] = {'s', 'i', 'l', 'l', 'y', 'S', 'N', 'P'};
+constexpr std::uint32_t snapshot_version = 1;
+constexpr std::size_t snapshot_align = 64;
+
+// writes a snapshot file, small values through a buffer and segments straight from the column
+class snapshot_writer
+{
+public:
+	snapshot_writer(const std::string &path) : fd{::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)}
+	{
+		if (fd < 0)
+			throw std::runtime_error("cannot open " + path + " for writing");
+	}
+
+	snapshot_writer(const snapshot_writer &) = delete;
+	snapshot_writer &operator=(const snapshot_writer &) = delete;
+
+	~snapshot_writer()
+	{
+		if (fd >= 0)
+			::close(fd);
+	}
+
+	template <typename T>
+	void put(const T &value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		auto bytes = reinterpret_cast<const char *>(&value);
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	void put_string(std::string_view str)
+	{
+		put(static_cast<std::uint64_t>(str.size()));
+		buffer.insert(buffer.end(), str.begin(), str.end());
+	}
+
+	// its size, then the bytes from the next aligned offset on
+	void segment(const void *data, std::size_t bytes)
+	{
+		put(static_cast<std::uint64_t>(bytes));
+		buffer.resize(buffer.size() + pad(offset + buffer.size()));
+		flush();
+		write_all(static_cast<const char *>(data), bytes);
+	}
+
+	// throws if anything failed to reach the file
+	void close()
+	{
+		flush();
+		int res = ::close(fd);
+		fd = -1;
+		if (res != 0)
+			throw std::runtime_error("cannot finish writing the snapshot");
+	}
+
+private:
+	int fd;
+	std::vector<char> buffer;
+	// bytes written to the file so far
+	std::size_t offset = 0;
+
+	static std::size_t pad(std::size_t at) { return (snapshot_align - at % snapshot_align) % snapshot_align; }
+
+	void flush()
+	{
+		write_all(buffer.data(), buffer.size());
+		buffer.clear();
+	}
+
+	void write_all(const char *data, std::size_t bytes)
+	{
+		offset += bytes;
+		while (bytes > 0)
+		{
+			auto n = ::write(fd, data, bytes);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+			data += n;
+			bytes -= static_cast<std::size_t>(n);
+		}
+	}
+};
+
+// maps a snapshot file and hands out its values and segments in the order they were written
+class snapshot_reader
+{
+public:
+	snapshot_reader(const std::string &path)
+	{
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("cannot open " + path);
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			size = static_cast<std::size_t>(st.st_size);
+			void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED)
+			{
+				madvise(map, size, MADV_SEQUENTIAL);
+				data = static_cast<const char *>(map);
+			}
+		}
+		::close(fd);
+
+		char magic[sizeof(snapshot_magic)];
+		if (!data || size < sizeof(magic) + sizeof(std::uint32_t))
+			throw std::runtime_error(path + " is not a snapshot");
+		std::memcpy(magic, take(sizeof(magic)), sizeof(magic));
+		if (!std::equal(magic, magic + sizeof(magic), snapshot_magic))
+			throw std::runtime_error(path + " is not a snapshot");
+		if (get<std::uint32_t>() != snapshot_version)
+			throw std::runtime_error(path + " was written by another version");
+	}
+
+	snapshot_reader(const snapshot_reader &) = delete;
+	snapshot_reader &operator=(const snapshot_reader &) = delete;
+
+	~snapshot_reader()
+	{
+		if (data)
+			munmap(const_cast<char *>(data), size);
+	}
+
+	template <typename T>
+	T get()
+	{
+		T value;
+		std::memcpy(&value, take(sizeof(T)), sizeof(T));
+		return value;
+	}
+
+	// the view stays valid as long as the reader
+	std::string_view get_string()
+	{
+		auto n = get<std::uint64_t>();
+		return {take(n), n};
+	}
+
+	// a segment of count values of type T, in place in the mapping
+	template <typename T>
+	const T *segment(std::size_t count)
+	{
+		auto bytes = get<std::uint64_t>();
+		if (count > std::numeric_limits<std::size_t>::max() / sizeof(T) || bytes != count * sizeof(T))
+			throw std::runtime_error("snapshot is corrupt");
+		pos += (snapshot_align - pos % snapshot_align) % snapshot_align;
+		return reinterpret_cast<const T *>(take(bytes));
+	}
+
+	// bytes not read yet, a bound on any count the rest of the file can hold
+	std::size_t remaining() const { return size - pos; }
+
+private:
+	const char *data = nullptr;
+	std::size_t size = 0, pos = 0;
+
+	const char *take(std::size_t n)
+	{
+		if (n > size || pos > size - n)
+			throw std::runtime_error("snapshot is truncated");
+		pos += n;
+		return data + pos - n;
+	}
+};
+
+// strings packed back to back in one buffer, row i spans [offsets[i], offsets[i + 1])
+class string_arena
+{
+public:
+	std::string_view operator[](std::size_t row) const { return {chars.data() + offsets[row], offsets[row + 1] - offsets[row]}; }
+	std::size_t size() const { return offsets.size() - 1; }
+
+	void reserve(std::size_t N)
+	{
+		// guess the bytes needed from the strings stored so far
+		if (size() > 0)
+			chars.reserve(N * (chars.size() / size() + 1));
+		offsets.reserve(N + 1);
+	}
+
+	void push_back(std::string_view str)
+	{
+		chars.insert(chars.end(), str.begin(), str.end());
+		offsets.push_back(chars.size());
+	}
+
+	// drops the given rows (sorted), moving each run of kept strings down with one memmove
+	void erase(const std::vector<std::size_t> &rows)
+	{
+		if (rows.empty())
+			return;
+
+		std::size_t out_row = rows.front(), out_char = offsets[out_row];
+		for (std::size_t k = 0; k < rows.size(); ++k)
+		{
+			std::size_t first = rows[k] + 1, last = k + 1 < rows.size() ? rows[k + 1] : size();
+			if (first >= last)
+				continue;
+
+			std::size_t begin = offsets[first], end = offsets[last];
+			std::memmove(chars.data() + out_char, chars.data() + begin, end - begin);
+			for (std::size_t r = first; r < last; ++r)
+				offsets[out_row++] = offsets[r] - begin + out_char;
+			out_char += end - begin;
+		}
+
+		offsets[out_row] = out_char;
+		offsets.resize(out_row + 1);
+		chars.resize(out_char);
+	}
+
+	void save(snapshot_writer &out) const
+	{
+		out.segment(offsets.data(), offsets.size() * sizeof(offsets[0]));
+		out.segment(chars.data(), chars.size());
+	}
+
+	// the offsets have to start at 0, never decrease and end at the size of the characters
+	void load(snapshot_reader &in, std::size_t rows)
+	{
+		if (rows >= in.remaining() / sizeof(std::size_t))
+			throw std::runtime_error("snapshot is corrupt");
+		auto offs = in.segment<std::size_t>(rows + 1);
+		if (offs[0] != 0 || !std::is_sorted(offs, offs + rows + 1))
+			throw std::runtime_error("snapshot is corrupt");
+		auto str = in.segment<char>(offs[rows]);
+		offsets.assign(offs, offs + rows + 1);
+		chars.assign(str, str + offs[rows]);
+	}
+
+private:
+	std::vector<char> chars;
+	std::vector<std::size_t> offsets{0};
+};
+
+inline void erase_rows(string_arena &data, const std::vector<std::size_t> &rows) { data.erase(rows); }
+
+// bools packed 64 to a word, bits past size() stay zero
+class bit_vector
+{
+public:
+	bool operator[](std::size_t i) const { return words[i >> 6] >> (i & 63) & 1; }
+	std::size_t size() const { return count; }
+	const std::vector<std::uint64_t> &blocks() const { return words; }
+
+	void reserve(std::size_t N) { words.reserve((N + 63) / 64); }
+
+	// set bits among rows [first, last)
+	std::size_t count_ones(std::size_t first, std::size_t last) const
+	{
+		if (first >= last)
+			return 0;
+
+		std::size_t fw = first >> 6, lw = (last - 1) >> 6;
+		if (fw == lw)
+			return static_cast<std::size_t>(__builtin_popcountll(words[fw] & range_mask(fw, first, last)));
+		return static_cast<std::size_t>(__builtin_popcountll(words[fw] & range_mask(fw, first, last))) +
+			   popcount_words(words.data() + fw + 1, lw - fw - 1) +
+			   static_cast<std::size_t>(__builtin_popcountll(words[lw] & range_mask(lw, first, last)));
+	}
+
+	// writes the rows in [first, last) whose bit equals value to out, returns how many
+	std::size_t select(bool value, std::size_t first, std::size_t last, std::size_t *out) const
+	{
+		if (first >= last)
+			return 0;
+
+		std::size_t n = 0;
+		auto flip = value ? std::uint64_t{0} : ~std::uint64_t{0};
+		for (std::size_t w = first >> 6; w <= (last - 1) >> 6; ++w)
+		{
+			for (auto bits = (words[w] ^ flip) & range_mask(w, first, last); bits; bits &= bits - 1)
+				out[n++] = w * 64 + static_cast<std::size_t>(__builtin_ctzll(bits));
+		}
+		return n;
+	}
+
+	void push_back(bool value)
+	{
+		if ((count & 63) == 0)
+			words.push_back(0);
+		words.back() |= static_cast<std::uint64_t>(value) << (count & 63);
+		++count;
+	}
+
+	void set(std::size_t i) { words[i >> 6] |= std::uint64_t{1} << (i & 63); }
+
+	// grows with zeros
+	void resize(std::size_t N)
+	{
+		count = std::max(count, N);
+		words.resize((count + 63) / 64);
+	}
+
+	void clear()
+	{
+		words.clear();
+		count = 0;
+	}
+
+	// drops the given rows (sorted), shifting the bits after the first one down in one pass
+	void erase(const std::vector<std::size_t> &rows)
+	{
+		if (rows.empty())
+			return;
+
+		std::size_t out = rows.front();
+		auto it = rows.begin();
+		for (std::size_t i = out; i < count; ++i)
+		{
+			if (it != rows.end() && *it == i)
+			{
+				++it;
+				continue;
+			}
+
+			auto mask = std::uint64_t{1} << (out & 63);
+			if ((*this)[i])
+				words[out >> 6] |= mask;
+			else
+				words[out >> 6] &= ~mask;
+			++out;
+		}
+
+		count = out;
+		words.resize((count + 63) / 64);
+		if (count & 63)
+			words.back() &= (std::uint64_t{1} << (count & 63)) - 1;
+	}
+
+	void save(snapshot_writer &out) const { out.segment(words.data(), words.size() * sizeof(words[0])); }
+
+	void load(snapshot_reader &in, std::size_t N)
+	{
+		auto blocks = in.segment<std::uint64_t>((N + 63) / 64);
+		words.assign(blocks, blocks + (N + 63) / 64);
+		count = N;
+		if (count & 63)
+			words.back() &= (std::uint64_t{1} << (count & 63)) - 1;
+	}
+
+private:
+	// the bits of word w that fall inside [first, last)
+	static std::uint64_t range_mask(std::size_t w, std::size_t first, std::size_t last)
+	{
+		auto mask = ~std::uint64_t{0};
+		if (w == first >> 6)
+			mask &= ~std::uint64_t{0} << (first & 63);
+		if (w == (last - 1) >> 6)
+			mask &= ~std::uint64_t{0} >> (63 - ((last - 1) & 63));
+		return mask;
+	}
+
+	std::vector<std::uint64_t> words;
+	std::size_t count = 0;
+};
+
+inline void erase_rows(bit_vector &data, const std::vector<std::size_t> &rows) { data.erase(rows); }
+
+// how a column of T keeps its rows
+template <typename T>
+struct column_storage
+{
+	using type = std::vector<T>;
+};
+
+template <>
+struct column_storage<std::string>
+{
+	using type = string_arena;
+};
+
+template <>
+struct column_storage<bool>
+{
+	using type = bit_vector;
+};
+
+// what commands did, for --stats and its summary at QUIT: main takes the difference around each
+// command. The counters go up once per scan, lookup, rebuild or buffer flush, never per row, so
+// they are always kept; only the command thread touches them
+struct exec_counters
+{
+	// rows a condition was checked on by a scan, or read by PRINT ALL or a hash join
+	std::size_t rows_scanned = 0;
+	// PRINT and DELETE conditions answered by an index, and JOIN rows looked up in one
+	std::size_t index_lookups = 0;
+	// stale indexes rebuilt from scratch on their next use
+	std::size_t index_rebuilds = 0;
+	// new or deleted rows merged into an index's arrays
+	std::size_t index_folds = 0;
+	// JOIN rows looked up in the other side, through an index or a hash table
+	std::size_t join_probes = 0;
+	// result text written by PRINT and JOIN
+	std::size_t bytes_out = 0;
+	// PRINT and JOIN commands --cache answered, and those it had to run
+	std::size_t cache_hits = 0, cache_misses = 0;
+};
+
+inline exec_counters counters;
+
+// the most chars an int, double or bool cell formats to
+constexpr std::size_t max_cell_chars = 32;
+
+// writes a cell at pos the way operator<< would, bools as with std::boolalpha, and returns the end
+inline char *format_cell(char *pos, int value) { return std::to_chars(pos, pos + max_cell_chars, value).ptr; }
+// %g with the default stream precision of 6
+inline char *format_cell(char *pos, double value) { return std::to_chars(pos, pos + max_cell_chars, value, std::chars_format::general, 6).ptr; }
+inline char *format_cell(char *pos, bool value)
+{
+	std::string_view text = value ? "true" : "false";
+	std::memcpy(pos, text.data(), text.size());
+	return pos + text.size();
+}
+
+// result text collected in one large buffer and handed to std::cout in big writes, with numbers
+// formatted by to_chars the way operator<< would, bools as with std::boolalpha. The buffer is
+// shared, so only one writer should be open at a time
+class result_writer
+{
+public:
+	result_writer() : buf{storage()}, pos{buf} {}
+	result_writer(const result_writer &) = delete;
+	result_writer &operator=(const result_writer &) = delete;
+	~result_writer() { flush(); }
+
+	void put(char c)
+	{
+		make_room(1);
+		*pos++ = c;
+	}
+
+	void put(std::string_view str)
+	{
+		if (str.size() > capacity)
+		{
+			flush();
+			std::cout.write(str.data(), static_cast<std::streamsize>(str.size()));
+			counters.bytes_out += str.size();
+			return;
+		}
+		make_room(str.size());
+		std::memcpy(pos, str.data(), str.size());
+		pos += str.size();
+	}
+
+	template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+	void put(T value)
+	{
+		make_room(max_cell_chars);
+		pos = format_cell(pos, value);
+	}
+
+	// room for n chars written straight at the returned position, then handed back with advance()
+	char *reserve(std::size_t n)
+	{
+		make_room(n);
+		return pos;
+	}
+	void advance(char *end) { pos = end; }
+
+	// the room reserve() can promise
+	static constexpr std::size_t max_reserve() { return capacity; }
+
+	void flush()
+	{
+		std::cout.write(buf, pos - buf);
+		counters.bytes_out += static_cast<std::size_t>(pos - buf);
+		pos = buf;
+	}
+
+private:
+	static constexpr std::size_t capacity = 1 << 18;
+
+	char *buf, *pos;
+
+	void make_room(std::size_t n)
+	{
+		if (static_cast<std::size_t>(buf + capacity - pos) < n)
+			flush();
+	}
+
+	static char *storage()
+	{
+		static std::unique_ptr<char[]> chars(new char[capacity]);
+		return chars.get();
+	}
+};
+
+// the formatted cells of one column for a batch of selected rows, back to back and each followed by
+// the space that separates it from the next column
+class cell_text
+{
+public:
+	// cells up to this long may be copied as a block of it, reading past their end
+	static constexpr std::size_t copy_block = 32;
+
+	std::size_t size() const { return ends.size() - 1; }
+	std::string_view operator[](std::size_t i) const { return {chars.data() + ends[i], ends[i + 1] - ends[i]}; }
+	// the length of the longest cell
+	std::size_t widest() const { return max_width; }
+
+	// n number cells, or cells of n strings totalling chars between them
+	void start(std::size_t n, std::size_t chars_needed)
+	{
+		// the separators, and slack so cells can be copied out a whole block at a time
+		chars_needed += n + copy_block;
+		if (chars.size() < chars_needed)
+			chars.resize(chars_needed);
+		ends.resize(1);
+		ends.reserve(n + 1);
+		pos = chars.data();
+		max_width = 0;
+	}
+
+	template <typename T>
+	void add(const T &value)
+	{
+		if constexpr (std::is_arithmetic_v<T>)
+			pos = format_cell(pos, value);
+		else
+		{
+			std::memcpy(pos, value.data(), value.size());
+			pos += value.size();
+		}
+		*pos++ = ' ';
+		ends.push_back(static_cast<std::size_t>(pos - chars.data()));
+		max_width = std::max(max_width, ends.back() - ends[ends.size() - 2]);
+	}
+
+private:
+	std::vector<char> chars;
+	std::vector<std::size_t> ends{0};
+	char *pos = nullptr;
+	std::size_t max_width = 0;
+};
+
+// formats values (gathered into a dense buffer) as the cells of out
+template <typename V>
+void format_cells(const std::vector<V> &values, cell_text &out)
+{
+	std::size_t chars = 0;
+	if constexpr (std::is_arithmetic_v<V>)
+		chars = values.size() * max_cell_chars;
+	else
+		for (const auto &value : values)
+			chars += value.size();
+
+	out.start(values.size(), chars);
+	for (const auto &value : values)
+		out.add(value);
+}
+
+// compare(row, value) == comp bound to one value, scans any range of rows and holds no scratch
+// state, so several threads can run one predicate over different ranges at once
+class predicate
+{
+public:
+	virtual std::size_t count(std::size_t first, std::size_t last) const = 0;
+	// appends the matching rows in [first, last) to out, in row order
+	virtual void select(std::size_t first, std::size_t last, std::vector<std::size_t> &out) const = 0;
+	// moves the matching rows among rows[0, n) to the front, in order, and returns how many there are
+	virtual std::size_t filter(std::size_t *rows, std::size_t n) const = 0;
+
+	virtual ~predicate() = default;
+};
+
+class column_base
+{
+public:
+	column_base(std::string_view _name) : name{_name} {}
+	std::string name;
+	// string columns created without an encoding hint, they may switch encoding once enough rows are in
+	bool adaptive = false;
+
+	virtual void write(std::size_t row, result_writer &out) const = 0;
+	// formats the cells of rows[0, n) into out, one column at a time
+	virtual void gather(const std::size_t *rows, std::size_t n, cell_text &out) const = 0;
+
+	virtual int compare(std::size_t row, const void *value) const = 0;
+	// the predicate compare() == comp over this column, value is copied
+	virtual std::unique_ptr<predicate> bind(const void *value, compare_t comp) const = 0;
+	// whole-column scans, one call per scan instead of one per row
+	std::size_t count_matching(const void *value, compare_t comp) const { return bind(value, comp)->count(0, size()); }
+	// appends the matching rows to out, in row order
+	void select_matching(const void *value, compare_t comp, std::vector<std::size_t> &out) const { bind(value, comp)->select(0, size(), out); }
+	// rows must be sorted
+	virtual void delete_rows(const std::vector<std::size_t> &rows) = 0;
+
+	virtual index_base *generate_index(index_type type) = 0;
+
+	// won't be dynamically allocated
+	virtual void *buff_from_str(std::string_view str) const = 0;
+	// won't be dynamically allocated
+	virtual void *buff_from_row(std::size_t row) const = 0;
+
+	virtual void reserve(std::size_t N) = 0;
+	// parses rows cells spaced stride apart straight into the column
+	virtual void append(const std::string_view *cells, std::size_t rows, std::size_t stride) = 0;
+	virtual std::size_t size() const = 0;
+
+	// returns a differently encoded copy when the data calls for one, nullptr to keep this column
+	virtual column_base *reencode() { return nullptr; }
+
+	// writes the column's kind, name and data to a snapshot, load_column reads it back
+	virtual void save(snapshot_writer &out) const = 0;
+
+	virtual ~column_base() = default;
+
+protected:
+	enum class kind : std::uint32_t
+	{
+		integer,
+		real,
+		boolean,
+		string,
+		dict,
+	};
+
+	void save_header(snapshot_writer &out, kind k) const
+	{
+		out.put(k);
+		out.put_string(name);
+		out.put(static_cast<std::uint8_t>(adaptive));
+	}
+
+	friend column_base *load_column(snapshot_reader &in, std::size_t rows);
+};
+
+template <typename T>
+class column : public column_base
+{
+public:
+	column(std::string_view name) : column_base(name) {}
+
+	void write(std::size_t row, result_writer &out) const override { out.put(data[row]); }
+
+	void gather(const std::size_t *rows, std::size_t n, cell_text &out) const override
+	{
+		thread_local std::vector<std::decay_t<decltype(data[0])>> values;
+		values.resize(n);
+		for (std::size_t i = 0; i < n; ++i)
+			values[i] = data[rows[i]];
+		format_cells(values, out);
+	}
+
+	int compare(std::size_t row, const void *value) const override { return compare_3way(data[row], *reinterpret_cast<const T *>(value)); }
+
+	std::unique_ptr<predicate> bind(const void *value, compare_t comp) const override
+	{
+		return std::make_unique<bound>(*this, *reinterpret_cast<const T *>(value), comp);
+	}
+
+	std::size_t count_range(const T &value, compare_t comp, std::size_t first, std::size_t last) const
+	{
+		if constexpr (std::is_same_v<T, int> || std::is_same_v<T, double>)
+			return scan_kernels<T>::get().count_matching(data.data(), first, last, value, comp);
+		else if constexpr (std::is_same_v<T, bool>)
+		{
+			bool target;
+			if (!bit_target(value, comp, target))
+				return 0;
+			auto ones = data.count_ones(first, last);
+			return target ? ones : last - first - ones;
+		}
+		else
+		{
+			std::size_t res = 0;
+			scan(value, comp, first, last, [&res](std::size_t, bool match)
+				 { res += match; });
+			return res;
+		}
+	}
+
+	void select_range(const T &value, compare_t comp, std::size_t first, std::size_t last, std::vector<std::size_t> &out) const
+	{
+		std::size_t n = out.size();
+		out.resize(n + (last - first));
+		auto dst = out.data() + n;
+		if constexpr (std::is_same_v<T, int> || std::is_same_v<T, double>)
+			n += scan_kernels<T>::get().select_matching(data.data(), first, last, value, comp, dst);
+		else if constexpr (std::is_same_v<T, bool>)
+		{
+			bool target;
+			if (bit_target(value, comp, target))
+				n += data.select(target, first, last, dst);
+		}
+		else
+		{
+			std::size_t k = 0;
+			scan(value, comp, first, last, [dst, &k](std::size_t row, bool match)
+				 { dst[k] = row; k += match; });
+			n += k;
+		}
+		out.resize(n);
+	}
+
+	// calls sink(row, matches) for every row in [first, last), each comparison gets its own branch-free loop
+	template <typename Sink>
+	void scan(const T &value, compare_t comp, std::size_t first, std::size_t last, Sink sink) const
+	{
+		switch (comp)
+		{
+		case compare_t::less:
+			return scan<compare_t::less>(value, first, last, sink);
+		case compare_t::greater:
+			return scan<compare_t::greater>(value, first, last, sink);
+		case compare_t::equals:
+			return scan<compare_t::equals>(value, first, last, sink);
+		}
+	}
+
+	template <compare_t C, typename Sink>
+	void scan(const T &value, std::size_t first, std::size_t last, Sink sink) const
+	{
+		for (std::size_t i = first; i < last; ++i)
+			sink(i, matches<C>(data[i], value));
+	}
+
+	std::size_t filter_rows(const T &value, compare_t comp, std::size_t *rows, std::size_t n) const
+	{
+		switch (comp)
+		{
+		case compare_t::less:
+			return filter_rows<compare_t::less>(value, rows, n);
+		case compare_t::greater:
+			return filter_rows<compare_t::greater>(value, rows, n);
+		case compare_t::equals:
+			return filter_rows<compare_t::equals>(value, rows, n);
+		}
+		return 0;
+	}
+
+	// every row is written back and the count decides whether it stays
+	template <compare_t C>
+	std::size_t filter_rows(const T &value, std::size_t *rows, std::size_t n) const
+	{
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			rows[kept] = rows[i];
+			kept += matches<C>(data[rows[i]], value);
+		}
+		return kept;
+	}
+
+	void delete_rows(const std::vector<std::size_t> &rows) override { erase_rows(data, rows); }
+
+	index_base *generate_index(index_type type) override;
+
+	void *buff_from_str(std::string_view str) const override
+	{
+		buffer = from_string<T>(str);
+		return &buffer;
+	}
+	void *buff_from_row(std::size_t row) const override
+	{
+		buffer = data[row];
+		return &buffer;
+	}
+
+	void reserve(std::size_t N) override { data.reserve(N); }
+	void append(const std::string_view *cells, std::size_t rows, std::size_t stride) override
+	{
+		for (std::size_t i = 0; i < rows; ++i)
+		{
+			if constexpr (std::is_same_v<T, std::string>)
+				data.push_back(cells[i * stride]);
+			else
+				data.push_back(from_string<T>(cells[i * stride]));
+		}
+	}
+	std::size_t size() const override { return data.size(); }
+
+	column_base *reencode() override;
+
+	void save(snapshot_writer &out) const override
+	{
+		if constexpr (std::is_same_v<T, int> || std::is_same_v<T, double>)
+		{
+			save_header(out, std::is_same_v<T, int> ? kind::integer : kind::real);
+			out.segment(data.data(), data.size() * sizeof(T));
+		}
+		else
+		{
+			save_header(out, std::is_same_v<T, bool> ? kind::boolean : kind::string);
+			data.save(out);
+		}
+	}
+
+	// the data of a column save() wrote with this many rows
+	void load(snapshot_reader &in, std::size_t rows)
+	{
+		if constexpr (std::is_same_v<T, int> || std::is_same_v<T, double>)
+		{
+			auto values = in.segment<T>(rows);
+			data.assign(values, values + rows);
+		}
+		else
+			data.load(in, rows);
+	}
+
+	// row value as a T, for index keys; strings and bools are copied into a reused buffer
+	const T &key(std::size_t row) const
+	{
+		if constexpr (std::is_same_v<decltype(data[row]), const T &>)
+			return data[row];
+		else
+		{
+			key_buffer = data[row];
+			return key_buffer;
+		}
+	}
+
+	typename column_storage<T>::type data;
+	mutable T buffer;
+
+private:
+	class bound : public predicate
+	{
+	public:
+		bound(const column &col, const T &value, compare_t comp) : col{col}, value{value}, comp{comp} {}
+
+		std::size_t count(std::size_t first, std::size_t last) const override { return col.count_range(value, comp, first, last); }
+		void select(std::size_t first, std::size_t last, std::vector<std::size_t> &out) const override { col.select_range(value, comp, first, last, out); }
+		std::size_t filter(std::size_t *rows, std::size_t n) const override { return col.filter_rows(value, comp, rows, n); }
+
+	private:
+		const column &col;
+		T value;
+		compare_t comp;
+	};
+
+	mutable T key_buffer;
+};
+
+class index_base
+{
+public:
+	index_base(column_base *owner) : ref{owner} {}
+
+	virtual index_type type() const = 0;
+	virtual void update(bool do_update) = 0;
+	// rebuilds the index now if update(true) marked it stale
+	virtual void refresh() = 0;
+	// whether the next lookup rebuilds it
+	virtual bool stale() const = 0;
+	// picks up rows [first, ref->size()) appended to the column
+	virtual void append_rows(std::size_t first) = 0;
+	// drops the given rows (sorted) and renumbers the rest, called before the column deletes them
+	virtual void delete_rows(const std::vector<std::size_t> &rows) = 0;
+	virtual std::size_t distinct() const = 0;
+	// rough heap bytes held
+	virtual std::size_t memory() const = 0;
+
+	virtual void do_on_matching_rows(const void *value, compare_t comp, std::function<void(std::size_t)> func) = 0;
+	// the number of rows do_on_matching_rows would visit, from per-key counts where the index keeps them
+	virtual std::size_t count_matching(const void *value, compare_t comp) = 0;
+	// don't use with multithreading, may return static data
+	// for use with delete_rows, returns sorted indices
+	virtual const std::vector<std::size_t> &get_matching_rows(const void *value, compare_t comp) = 0;
+
+	// calls func(probe_row, row) for each pair of equal values, in probe row order
+	virtual void join(const column_base &probe, const std::function<void(std::size_t, std::size_t)> &func)
+	{
+		for (std::size_t i1 = 0; i1 < probe.size(); ++i1)
+			do_on_matching_rows(probe.buff_from_row(i1), compare_t::equals, [i1, &func](std::size_t i2)
+								{ func(i1, i2); });
+	}
+
+	// the number of pairs join would call func with, from the rows per key
+	virtual std::size_t count_join(const column_base &probe)
+	{
+		std::size_t n = 0;
+		for (std::size_t i1 = 0; i1 < probe.size(); ++i1)
+			n += count_matching(probe.buff_from_row(i1), compare_t::equals);
+		return n;
+	}
+
+	virtual ~index_base() = default;
+
+	column_base *ref;
+};
+
+// heap bytes a key owns beyond its own size
+template <typename K>
+std::size_t heap_bytes(const K &) { return 0; }
+inline std::size_t heap_bytes(const std::string &key) { return key.capacity() > 15 ? key.capacity() + 1 : 0; }
+
+// rough heap bytes of a map from keys to row lists: a node per key carrying node_links pointers of
+// bookkeeping, the row lists, and what the keys own
+template <typename Map>
+std::size_t row_lists_memory(const Map &map, std::size_t node_links)
+{
+	std::size_t bytes = map.size() * (sizeof(typename Map::value_type) + node_links * sizeof(void *));
+	for (auto &entry : map)
+		bytes += entry.second.capacity() * sizeof(std::size_t) + heap_bytes(entry.first);
+	return bytes;
+}
+
+// renumbers a sorted row list for the delete of rows (sorted), dropping the deleted ones
+inline void shift_rows(std::vector<std::size_t> &list, const std::vector<std::size_t> &rows)
+{
+	auto out = std::lower_bound(list.begin(), list.end(), rows.front());
+	auto d = rows.begin();
+	for (auto it = out; it != list.end(); ++it)
+	{
+		d = std::lower_bound(d, rows.end(), *it);
+		if (d == rows.end() || *d != *it)
+			*out++ = *it - static_cast<std::size_t>(d - rows.begin());
+	}
+	list.erase(out, list.end());
+}
+
+// 64-bit finalizer so both the high (partition) and low (bucket) bits of a key hash are usable
+inline std::uint64_t mix_hash(std::uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// hash of a key for the hash tables, equal keys hash equal (-0.0 and 0.0 as well)
+template <typename K>
+std::uint64_t hash_key(const K &key)
+{
+	if constexpr (std::is_same_v<K, double>)
+	{
+		double v = key;
+		if (v == 0) // -0.0 == 0.0
+			v = 0;
+		std::uint64_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		return mix_hash(bits);
+	}
+	else if constexpr (std::is_same_v<K, std::string> || std::is_same_v<K, std::string_view>)
+		return mix_hash(std::hash<std::string_view>{}(key));
+	else
+		return mix_hash(static_cast<std::uint64_t>(key));
+}
+
+// row ids packed 32 bits each, switching to 64 once one doesn't fit
+class row_array
+{
+public:
+	std::size_t operator[](std::size_t i) const { return wide ? rows64[i] : rows32[i]; }
+	std::size_t size() const { return wide ? rows64.size() : rows32.size(); }
+	std::size_t memory() const { return rows32.capacity() * sizeof(rows32[0]) + rows64.capacity() * sizeof(rows64[0]); }
+
+	// room for N rows none of which is above max_row
+	void reserve(std::size_t N, std::size_t max_row)
+	{
+		if (!wide && max_row > std::numeric_limits<std::uint32_t>::max())
+			widen();
+		if (wide)
+			rows64.reserve(N);
+		else
+			rows32.reserve(N);
+	}
+
+	// N rows, none of them above max_row, to be filled in with set
+	void resize(std::size_t N, std::size_t max_row)
+	{
+		if (!wide && max_row > std::numeric_limits<std::uint32_t>::max())
+			widen();
+		if (wide)
+			rows64.resize(N);
+		else
+			rows32.resize(N);
+	}
+
+	void set(std::size_t i, std::size_t row)
+	{
+		if (wide)
+			rows64[i] = row;
+		else
+			rows32[i] = static_cast<std::uint32_t>(row);
+	}
+
+	void push_back(std::size_t row)
+	{
+		if (!wide && row > std::numeric_limits<std::uint32_t>::max())
+			widen();
+		if (wide)
+			rows64.push_back(row);
+		else
+			rows32.push_back(static_cast<std::uint32_t>(row));
+	}
+
+	void swap(row_array &other)
+	{
+		rows32.swap(other.rows32);
+		rows64.swap(other.rows64);
+		std::swap(wide, other.wide);
+	}
+
+private:
+	void widen()
+	{
+		rows64.assign(rows32.begin(), rows32.end());
+		std::vector<std::uint32_t>().swap(rows32);
+		wide = true;
+	}
+
+	std::vector<std::uint32_t> rows32;
+	std::vector<std::size_t> rows64;
+	bool wide = false;
+};
+
+// equality lookups through a flat open addressing table of the distinct keys. Each key's rows sit
+// together in one array, in row order; rows appended since that array was built are chained per
+// key until there are enough of them to fold in
+template <typename T>
+class hash_index : public index_base
+{
+public:
+	hash_index(column<T> *owner) : index_base(owner), col{owner}, needs_to_update{false}
+	{
+		update_map();
+	}
+
+	index_type type() const override { return index_type::hash; }
+
+	void update(bool do_update) override
+	{
+		needs_to_update = do_update;
+	}
+
+	void refresh() override
+	{
+		if (needs_to_update)
+		{
+			update_map();
+			needs_to_update = false;
+			++counters.index_rebuilds;
+		}
+	}
+
+	bool stale() const override { return needs_to_update; }
+
+	void append_rows(std::size_t first) override
+	{
+		if (first == col->data.size())
+			return;
+
+		if (needs_to_update) // the rebuild sees the new rows as well
+		{
+			update_map();
+			needs_to_update = false;
+			++counters.index_rebuilds;
+			return;
+		}
+
+		for (std::size_t i = first; i < col->data.size(); ++i)
+			add_tail(intern(col->key(i)), i);
+
+		// folding is linear in the whole index, so wait until it pays for itself
+		if (tail_next.size() > std::max<std::size_t>(4096, built_rows / 8))
+			fold({});
+	}
+
+	void delete_rows(const std::vector<std::size_t> &deleted) override
+	{
+		if (deleted.empty() || needs_to_update) // a pending rebuild sees the delete anyway
+			return;
+
+		fold(deleted);
+
+		// drop the keys left without rows once they are most of the table
+		if (num_distinct * 2 < keys.size())
+			needs_to_update = true;
+	}
+
+	std::size_t distinct() const override { return num_distinct; }
+	std::size_t memory() const override
+	{
+		std::size_t bytes = keys.capacity() * sizeof(T) + hashes.capacity() * sizeof(hashes[0]) +
+							counts.capacity() * sizeof(counts[0]) + slots.capacity() * sizeof(slots[0]) +
+							begin.capacity() * sizeof(begin[0]) + rows.memory() +
+							(tail_head.capacity() + tail_last.capacity() + tail_next.capacity()) * sizeof(std::size_t);
+		for (const T &key : keys)
+			bytes += heap_bytes(key);
+		return bytes;
+	}
+
+	void do_on_matching_rows(const void *value, compare_t comp, std::function<void(std::size_t)> func) override
+	{
+		if (comp == compare_t::equals)
+		{
+			refresh();
+
+			auto k = find(*reinterpret_cast<const T *>(value));
+			if (k != npos)
+				for_each_row(k, func);
+		}
+		else
+		{
+			for (auto i : get_matching_rows(value, comp))
+				func(i);
+		}
+	}
+
+	// ranges have no order here, those are a scan of the column
+	std::size_t count_matching(const void *value, compare_t comp) override
+	{
+		if (comp != compare_t::equals)
+			return ref->count_matching(value, comp);
+
+		refresh();
+		auto k = find(*reinterpret_cast<const T *>(value));
+		return k == npos ? 0 : counts[k];
+	}
+
+	const std::vector<std::size_t> &get_matching_rows(const void *value, compare_t comp) override
+	{
+		static std::vector<std::size_t> buffer;
+		buffer.clear();
+		if (comp == compare_t::equals)
+		{
+			refresh();
+
+			auto k = find(*reinterpret_cast<const T *>(value));
+			if (k != npos)
+			{
+				buffer.reserve(counts[k]);
+				for_each_row(k, [](std::size_t row)
+							 { buffer.push_back(row); });
+			}
+		}
+		else
+			ref->select_matching(value, comp, buffer);
+		return buffer;
+	}
+
+	// probes with the keys of a column of the same type directly instead of through buff_from_row
+	void join(const column_base &probe, const std::function<void(std::size_t, std::size_t)> &func) override
+	{
+		auto probe_col = dynamic_cast<const column<T> *>(&probe);
+		if (!probe_col)
+			return index_base::join(probe, func);
+
+		refresh();
+		for (std::size_t i1 = 0; i1 < probe_col->size(); ++i1)
+		{
+			auto k = find(probe_col->key(i1));
+			if (k != npos)
+				for_each_row(k, [i1, &func](std::size_t i2)
+							 { func(i1, i2); });
+		}
+	}
+
+	std::size_t count_join(const column_base &probe) override
+	{
+		auto probe_col = dynamic_cast<const column<T> *>(&probe);
+		if (!probe_col)
+			return index_base::count_join(probe);
+
+		refresh();
+		std::size_t n = 0;
+		for (std::size_t i1 = 0; i1 < probe_col->size(); ++i1)
+		{
+			auto k = find(probe_col->key(i1));
+			if (k != npos)
+				n += counts[k];
+		}
+		return n;
+	}
+
+private:
+	static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+	// 1 + the id of the key in it, 0 for an empty slot, and the top half of that key's hash so most
+	// probes that would miss don't look at the key
+	struct slot
+	{
+		std::uint32_t key, tag;
+	};
+
+	column<T> *col;
+	bool needs_to_update;
+
+	// the distinct keys by id with their hashes and row counts, keys that lost all their rows to
+	// deletes stay until the next rebuild
+	std::vector<T> keys;
+	std::vector<std::uint64_t> hashes;
+	std::vector<std::size_t> counts;
+	std::size_t num_distinct = 0;
+	// linear probing, never more than half full
+	std::vector<slot> slots;
+	// the rows of key k up to built_rows are rows[begin[k], begin[k + 1]), for the keys there were then
+	std::vector<std::size_t> begin{0};
+	row_array rows;
+	std::size_t built_rows = 0;
+	// later rows: tail_head and tail_last per key, tail_next[row - built_rows] the key's next row
+	std::vector<std::size_t> tail_head, tail_last, tail_next;
+
+	// the id of key, npos if it isn't there
+	std::size_t find(const T &key) const
+	{
+		auto h = hash_key(key);
+		auto mask = slots.size() - 1;
+		auto tag = static_cast<std::uint32_t>(h >> 32);
+		for (auto i = h & mask;; i = (i + 1) & mask)
+		{
+			auto &s = slots[i];
+			if (s.key == 0)
+				return npos;
+			if (s.tag == tag && keys[s.key - 1] == key)
+				return s.key - 1;
+		}
+	}
+
+	// the id of key, which gets one with no rows if it is new
+	std::size_t intern(const T &key)
+	{
+		if ((keys.size() + 1) * 2 > slots.size())
+			grow();
+
+		auto h = hash_key(key);
+		auto mask = slots.size() - 1;
+		auto tag = static_cast<std::uint32_t>(h >> 32);
+		auto i = h & mask;
+		for (; slots[i].key != 0; i = (i + 1) & mask)
+			if (slots[i].tag == tag && keys[slots[i].key - 1] == key)
+				return slots[i].key - 1;
+
+		if (keys.size() == std::numeric_limits<std::uint32_t>::max())
+			throw std::length_error("hash index is full");
+
+		slots[i] = {static_cast<std::uint32_t>(keys.size() + 1), tag};
+		keys.push_back(key);
+		hashes.push_back(h);
+		counts.push_back(0);
+		tail_head.push_back(npos);
+		tail_last.push_back(npos);
+		return keys.size() - 1;
+	}
+
+	void grow()
+	{
+		std::vector<slot> old(std::max<std::size_t>(16, slots.size() * 2));
+		old.swap(slots);
+		auto mask = slots.size() - 1;
+		for (std::size_t k = 0; k < keys.size(); ++k)
+		{
+			auto i = hashes[k] & mask;
+			while (slots[i].key != 0)
+				i = (i + 1) & mask;
+			slots[i] = {static_cast<std::uint32_t>(k + 1), static_cast<std::uint32_t>(hashes[k] >> 32)};
+		}
+	}
+
+	template <typename F>
+	void for_each_row(std::size_t k, F &&f) const
+	{
+		if (k + 1 < begin.size())
+			for (auto i = begin[k]; i < begin[k + 1]; ++i)
+				f(rows[i]);
+		for (auto row = tail_head[k]; row != npos; row = tail_next[row - built_rows])
+			f(row);
+	}
+
+	void add_tail(std::size_t k, std::size_t row)
+	{
+		if (counts[k]++ == 0)
+			++num_distinct;
+		tail_next.push_back(npos);
+		if (tail_head[k] == npos)
+			tail_head[k] = row;
+		else
+			tail_next[tail_last[k] - built_rows] = row;
+		tail_last[k] = row;
+	}
+
+	// rebuilds the row array with the tail in it, leaving out the deleted rows (sorted) and
+	// renumbering the rest
+	void fold(const std::vector<std::size_t> &deleted)
+	{
+		++counters.index_folds;
+		std::size_t K = keys.size(), total = built_rows + tail_next.size();
+		auto first_deleted = deleted.empty() ? npos : deleted.front();
+
+		std::vector<std::size_t> new_begin(K + 1);
+		row_array new_rows;
+		new_rows.reserve(total - deleted.size(), total);
+		for (std::size_t k = 0; k < K; ++k)
+		{
+			new_begin[k] = new_rows.size();
+			auto d = deleted.begin();
+			for_each_row(k, [&](std::size_t row)
+						 {
+							 if (row < first_deleted)
+								 return new_rows.push_back(row);
+							 d = std::lower_bound(d, deleted.end(), row);
+							 if (d == deleted.end() || *d != row)
+								 new_rows.push_back(row - static_cast<std::size_t>(d - deleted.begin())); });
+
+			auto n = new_rows.size() - new_begin[k];
+			if (counts[k] != 0 && n == 0)
+				--num_distinct;
+			counts[k] = n;
+		}
+		new_begin[K] = new_rows.size();
+
+		begin.swap(new_begin);
+		rows.swap(new_rows);
+		built_rows = total - deleted.size();
+		tail_head.assign(K, npos);
+		tail_last.assign(K, npos);
+		tail_next.clear();
+	}
+
+	void update_map()
+	{
+		std::size_t N = col->data.size();
+		keys.clear();
+		hashes.clear();
+		counts.clear();
+		tail_head.clear();
+		tail_last.clear();
+		tail_next.clear();
+		slots.assign(16, slot{0, 0});
+
+		// one lookup per row, then a counting sort of the rows by key
+		std::vector<std::uint32_t> row_keys(N);
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			auto k = intern(col->key(i));
+			row_keys[i] = static_cast<std::uint32_t>(k);
+			++counts[k];
+		}
+		num_distinct = keys.size();
+
+		std::size_t K = keys.size();
+		begin.assign(K + 1, 0);
+		for (std::size_t k = 0; k < K; ++k)
+			begin[k + 1] = begin[k] + counts[k];
+
+		std::vector<std::size_t> next(begin.begin(), begin.end() - 1);
+		row_array sorted;
+		sorted.resize(N, N);
+		for (std::size_t i = 0; i < N; ++i)
+			sorted.set(next[row_keys[i]]++, i);
+		rows.swap(sorted);
+
+		built_rows = N;
+		tail_head.assign(K, npos);
+		tail_last.assign(K, npos);
+	}
+};
+
+// strict weak order of index keys: < except that NaNs sort after every number
+template <typename A, typename B>
+bool key_less(const A &a, const B &b)
+{
+	if constexpr (std::is_floating_point_v<A>)
+		return a < b || (!std::isnan(a) && std::isnan(b));
+	else
+		return a < b;
+}
+
+template <typename V>
+bool is_nan_key(const V &v)
+{
+	if constexpr (std::is_floating_point_v<V>)
+		return std::isnan(v);
+	else
+		return false;
+}
+
+struct key_order
+{
+	using is_transparent = void;
+
+	template <typename A, typename B>
+	bool operator()(const A &a, const B &b) const { return key_less(a, b); }
+};
+
+// storage of an ordered index: the distinct keys in a sorted array and each key's rows together in
+// one array, in row order. Rows added since the arrays were built wait in a small tree keyed the
+// same way until there are enough of them to merge in; lookups read both
+template <typename K>
+class sorted_runs
+{
+public:
+	// how keys are handed out and compared across indexes, strings as views
+	using view_type = std::conditional_t<std::is_same_v<K, std::string>, std::string_view, K>;
+
+	// keys in the arrays, pending ones not included
+	std::size_t size() const { return keys.size(); }
+	view_type key(std::size_t k) const { return keys[k]; }
+	std::size_t count(std::size_t k) const { return begin[k + 1] - begin[k]; }
+
+	template <typename F>
+	void for_each_row(std::size_t k, F &&f) const
+	{
+		for (auto i = begin[k]; i < begin[k + 1]; ++i)
+			f(rows[i]);
+	}
+
+	// the first key position from k on whose key isn't less than v, a few steps forward before a
+	// binary search for long runs of keys that aren't wanted
+	template <typename V>
+	std::size_t skip_to(std::size_t k, const V &v) const
+	{
+		for (int step = 0; step < 8; ++step)
+			if (++k == keys.size() || !key_less(keys[k], v))
+				return k;
+		return static_cast<std::size_t>(std::lower_bound(keys.begin() + static_cast<std::ptrdiff_t>(k), keys.end(), v, key_order{}) - keys.begin());
+	}
+
+	std::size_t distinct() const { return num_distinct; }
+	std::size_t memory() const
+	{
+		std::size_t bytes = keys.capacity() * sizeof(K) + begin.capacity() * sizeof(begin[0]) + rows.memory() + row_lists_memory(pending, 4);
+		for (const K &key : keys)
+			bytes += heap_bytes(key);
+		return bytes;
+	}
+
+	// from scratch over rows [0, N), key_of(row) returns a row's key by value
+	template <typename KeyOf>
+	void build(std::size_t N, KeyOf key_of)
+	{
+		using V = std::decay_t<decltype(key_of(std::size_t{}))>;
+		std::vector<std::pair<V, std::size_t>> sorted(N);
+		for (std::size_t i = 0; i < N; ++i)
+			sorted[i] = {key_of(i), i};
+		std::stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b)
+						 { return key_less(a.first, b.first); });
+
+		keys.clear();
+		begin.assign(1, 0);
+		pending.clear();
+		num_pending = 0;
+		row_array res;
+		res.resize(N, N);
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			if (i == 0 || key_less(sorted[i - 1].first, sorted[i].first))
+			{
+				keys.emplace_back(sorted[i].first);
+				begin.push_back(i);
+			}
+			res.set(i, sorted[i].second);
+			++begin.back();
+		}
+		rows.swap(res);
+		num_distinct = keys.size();
+	}
+
+	// row comes after every row added so far
+	template <typename V>
+	void add(const V &v, std::size_t row)
+	{
+		auto it = pending.find(v);
+		if (it == pending.end())
+		{
+			if (!std::binary_search(keys.begin(), keys.end(), v, key_order{}))
+				++num_distinct;
+			it = pending.emplace(K(v), std::vector<std::size_t>()).first;
+		}
+		it->second.push_back(row);
+
+		// merging is linear in the whole index, so wait until it pays for itself
+		if (++num_pending > std::max<std::size_t>(4096, rows.size() / 8))
+			fold();
+	}
+
+	// merges the pending rows into the arrays
+	void fold()
+	{
+		if (pending.empty())
+			return;
+		++counters.index_folds;
+
+		std::vector<K> new_keys;
+		std::vector<std::size_t> new_begin(1, 0);
+		row_array new_rows;
+		new_keys.reserve(num_distinct);
+		new_begin.reserve(num_distinct + 1);
+		new_rows.reserve(rows.size() + num_pending, rows.size() + num_pending);
+
+		std::size_t k = 0;
+		auto it = pending.begin();
+		while (k < keys.size() || it != pending.end())
+		{
+			bool from_arrays = k < keys.size() && (it == pending.end() || !key_less(it->first, keys[k]));
+			bool from_pending = it != pending.end() && (k == keys.size() || !key_less(keys[k], it->first));
+			new_keys.push_back(from_arrays ? std::move(keys[k]) : it->first);
+			// a key in both has its older rows in the arrays
+			if (from_arrays)
+				for_each_row(k++, [&new_rows](std::size_t row)
+							 { new_rows.push_back(row); });
+			if (from_pending)
+				for (auto row : (it++)->second)
+					new_rows.push_back(row);
+			new_begin.push_back(new_rows.size());
+		}
+
+		keys.swap(new_keys);
+		begin.swap(new_begin);
+		rows.swap(new_rows);
+		pending.clear();
+		num_pending = 0;
+	}
+
+	// drops the deleted rows (sorted), renumbers the rest and drops keys left without rows
+	void erase(const std::vector<std::size_t> &deleted)
+	{
+		fold();
+		++counters.index_folds;
+
+		std::vector<std::size_t> new_begin(1, 0);
+		row_array new_rows;
+		new_rows.reserve(rows.size() - deleted.size(), rows.size());
+		std::size_t kept = 0;
+		for (std::size_t k = 0; k < keys.size(); ++k)
+		{
+			auto d = deleted.begin();
+			for_each_row(k, [&](std::size_t row)
+						 {
+							 if (row < deleted.front())
+								 return new_rows.push_back(row);
+							 d = std::lower_bound(d, deleted.end(), row);
+							 if (d == deleted.end() || *d != row)
+								 new_rows.push_back(row - static_cast<std::size_t>(d - deleted.begin())); });
+
+			if (new_rows.size() != new_begin.back())
+			{
+				if (kept != k)
+					keys[kept] = std::move(keys[k]);
+				++kept;
+				new_begin.push_back(new_rows.size());
+			}
+		}
+
+		keys.erase(keys.begin() + static_cast<std::ptrdiff_t>(kept), keys.end());
+		begin.swap(new_begin);
+		rows.swap(new_rows);
+		num_distinct = keys.size();
+	}
+
+	// calls f(row) for the rows whose key compares to v as comp, in key order and then row order
+	template <typename V, typename F>
+	void for_each_matching(const V &v, compare_t comp, F &&f) const
+	{
+		auto [k, k_end] = key_range(v, comp);
+		auto [it, it_end] = pending_range(v, comp);
+
+		while (k != k_end || it != it_end)
+		{
+			bool from_arrays = k != k_end && (it == it_end || !key_less(it->first, keys[k]));
+			bool from_pending = it != it_end && (k == k_end || !key_less(keys[k], it->first));
+			if (from_arrays)
+				for_each_row(k++, f);
+			if (from_pending)
+				for (auto row : (it++)->second)
+					f(row);
+		}
+	}
+
+	// the number of rows whose key compares to v as comp without visiting them: begin already holds
+	// the running row counts of the arrays, only pending keys in range are walked
+	template <typename V>
+	std::size_t count_matching(const V &v, compare_t comp) const
+	{
+		auto [k, k_end] = key_range(v, comp);
+		auto [it, it_end] = pending_range(v, comp);
+		std::size_t res = begin[k_end] - begin[k];
+		for (; it != it_end; ++it)
+			res += it->second.size();
+		return res;
+	}
+
+	// appends the rows among [0, N) whose key compares to v as comp to out, in row order: the rows
+	// of one key already are, the rows of a range of keys are marked in a bitmap and read back
+	template <typename V>
+	void select(const V &v, compare_t comp, std::size_t N, std::vector<std::size_t> &out) const
+	{
+		if (comp == compare_t::equals)
+			return for_each_matching(v, comp, [&out](std::size_t row)
+									 { out.push_back(row); });
+
+		static bit_vector marks;
+		marks.clear();
+		marks.resize(N);
+		std::size_t M = 0;
+		for_each_matching(v, comp, [&M](std::size_t row)
+						  { marks.set(row); ++M; });
+
+		auto n = out.size();
+		out.resize(n + M);
+		marks.select(true, 0, N, out.data() + n);
+	}
+
+private:
+	using pending_map = std::map<K, std::vector<std::size_t>, key_order>;
+
+	std::vector<K> keys;
+	// the rows of key k are rows[begin[k], begin[k + 1])
+	std::vector<std::size_t> begin{0};
+	row_array rows;
+	pending_map pending;
+	std::size_t num_pending = 0, num_distinct = 0;
+
+	// the end of the keys that aren't NaN in the arrays and among the pending keys
+	std::size_t ordered_end() const
+	{
+		if constexpr (std::is_floating_point_v<K>)
+			return static_cast<std::size_t>(std::lower_bound(keys.begin(), keys.end(), std::numeric_limits<K>::quiet_NaN(), key_order{}) - keys.begin());
+		else
+			return keys.size();
+	}
+
+	typename pending_map::const_iterator ordered_pending_end() const
+	{
+		if constexpr (std::is_floating_point_v<K>)
+			return pending.lower_bound(std::numeric_limits<K>::quiet_NaN());
+		else
+			return pending.end();
+	}
+
+	// the key positions [first, last) in the arrays that compare to v as comp
+	template <typename V>
+	std::pair<std::size_t, std::size_t> key_range(const V &v, compare_t comp) const
+	{
+		auto lower = [this, &v]()
+		{ return static_cast<std::size_t>(std::lower_bound(keys.begin(), keys.end(), v, key_order{}) - keys.begin()); };
+		auto upper = [this, &v]()
+		{ return static_cast<std::size_t>(std::upper_bound(keys.begin(), keys.end(), v, key_order{}) - keys.begin()); };
+
+		// NaN keys sort last but compare to nothing, so they are in no range and a NaN value has none
+		if (is_nan_key(v))
+			return {0, 0};
+		if (comp == compare_t::less)
+			return {0, lower()};
+		if (comp == compare_t::greater)
+			return {upper(), ordered_end()};
+		return {lower(), upper()};
+	}
+
+	// the same range among the pending keys
+	template <typename V>
+	std::pair<typename pending_map::const_iterator, typename pending_map::const_iterator> pending_range(const V &v, compare_t comp) const
+	{
+		if (is_nan_key(v))
+			return {pending.end(), pending.end()};
+		if (comp == compare_t::less)
+			return {pending.begin(), pending.lower_bound(v)};
+		if (comp == compare_t::greater)
+			return {pending.upper_bound(v), ordered_pending_end()};
+		return pending.equal_range(v);
+	}
+};
+
+// ordered lookups over a sorted key array, ranges come out in key order
+template <typename T>
+class bst_index : public index_base
+{
+public:
+	bst_index(column<T> *owner) : index_base(owner), col{owner}, needs_to_update{false}
+	{
+		update_map();
+	}
+
+	index_type type() const override { return index_type::bst; }
+
+	void update(bool do_update) override
+	{
+		needs_to_update = do_update;
+	}
+
+	void refresh() override
+	{
+		if (needs_to_update)
+		{
+			update_map();
+			needs_to_update = false;
+			++counters.index_rebuilds;
+		}
+	}
+
+	bool stale() const override { return needs_to_update; }
+
+	void append_rows(std::size_t first) override
+	{
+		if (first == col->data.size())
+			return;
+
+		if (needs_to_update) // the rebuild sees the new rows as well
+		{
+			update_map();
+			needs_to_update = false;
+			++counters.index_rebuilds;
+			return;
+		}
+
+		for (std::size_t i = first; i < col->data.size(); ++i)
+			runs.add(col->data[i], i);
+	}
+
+	void delete_rows(const std::vector<std::size_t> &rows) override
+	{
+		if (rows.empty() || needs_to_update) // a pending rebuild sees the delete anyway
+			return;
+
+		runs.erase(rows);
+	}
+
+	std::size_t distinct() const override { return runs.distinct(); }
+	std::size_t memory() const override { return runs.memory(); }
+
+	void do_on_matching_rows(const void *value, compare_t comp, std::function<void(std::size_t)> func) override
+	{
+		refresh();
+		runs.for_each_matching(*reinterpret_cast<const T *>(value), comp, func);
+	}
+
+	std::size_t count_matching(const void *value, compare_t comp) override
+	{
+		refresh();
+		return runs.count_matching(*reinterpret_cast<const T *>(value), comp);
+	}
+
+	const std::vector<std::size_t> &get_matching_rows(const void *value, compare_t comp) override
+	{
+		static std::vector<std::size_t> buffer;
+		buffer.clear();
+		refresh();
+		runs.select(*reinterpret_cast<const T *>(value), comp, col->data.size(), buffer);
+		return buffer;
+	}
+
+	// probes with the keys of a column of the same type directly instead of through buff_from_row
+	void join(const column_base &probe, const std::function<void(std::size_t, std::size_t)> &func) override
+	{
+		auto probe_col = dynamic_cast<const column<T> *>(&probe);
+		if (!probe_col)
+			return index_base::join(probe, func);
+
+		refresh();
+		for (std::size_t i1 = 0; i1 < probe_col->size(); ++i1)
+			runs.for_each_matching(probe_col->data[i1], compare_t::equals, [i1, &func](std::size_t i2)
+								   { func(i1, i2); });
+	}
+
+	std::size_t count_join(const column_base &probe) override
+	{
+		auto probe_col = dynamic_cast<const column<T> *>(&probe);
+		if (!probe_col)
+			return index_base::count_join(probe);
+
+		refresh();
+		std::size_t n = 0;
+		for (std::size_t i1 = 0; i1 < probe_col->size(); ++i1)
+			n += runs.count_matching(probe_col->data[i1], compare_t::equals);
+		return n;
+	}
+
+	// the keys and their rows in key order, with nothing pending
+	const sorted_runs<T> &entries()
+	{
+		refresh();
+		runs.fold();
+		return runs;
+	}
+
+private:
+	sorted_runs<T> runs;
+	column<T> *col;
+	bool needs_to_update;
+
+	void update_map()
+	{
+		runs.build(col->data.size(), [this](std::size_t row)
+				   { return col->data[row]; });
+	}
+};
+
+// distinct strings of a column, each with a dense 32-bit code in order of first appearance
+class string_dictionary
+{
+public:
+	static constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+
+	std::uint32_t intern(std::string_view str)
+	{
+		auto it = codes.find(str);
+		if (it != codes.end())
+			return it->second;
+
+		if (values.size() == npos)
+			throw std::length_error("string dictionary is full");
+
+		auto code = static_cast<std::uint32_t>(values.size());
+		values.emplace_back(str);
+		codes.emplace(values.back(), code);
+		return code;
+	}
+
+	// npos if the string isn't in the dictionary
+	std::uint32_t find(std::string_view str) const
+	{
+		auto it = codes.find(str);
+		return it == codes.end() ? npos : it->second;
+	}
+
+	const std::string &operator[](std::uint32_t code) const { return values[code]; }
+	std::size_t size() const { return values.size(); }
+
+private:
+	// deque so the views in codes stay valid as it grows
+	std::deque<std::string> values;
+	std::unordered_map<std::string_view, std::uint32_t> codes;
+};
+
+// a string column stored as one dictionary code per row, for columns with few distinct values
+class dict_column : public column_base
+{
+public:
+	// rows a column gets before an adaptive column picks its encoding
+	static constexpr std::size_t sample_rows = 1024;
+
+	dict_column(std::string_view name) : column_base(name) {}
+
+	void write(std::size_t row, result_writer &out) const override { out.put(std::string_view(dict[codes[row]])); }
+
+	void gather(const std::size_t *rows, std::size_t n, cell_text &out) const override
+	{
+		thread_local std::vector<std::string_view> values;
+		values.resize(n);
+		for (std::size_t i = 0; i < n; ++i)
+			values[i] = dict[codes[rows[i]]];
+		format_cells(values, out);
+	}
+
+	int compare(std::size_t row, const void *value) const override
+	{
+		if (value != &buffer)
+			return compare_3way(std::string_view(dict[codes[row]]), *reinterpret_cast<const std::string *>(value));
+
+		// every row with the same code compares the same way, so compare each dictionary entry once
+		if (buffer_order.size() != dict.size())
+		{
+			for (auto code = static_cast<std::uint32_t>(buffer_order.size()); code < dict.size(); ++code)
+				buffer_order.push_back(static_cast<signed char>(compare_3way(std::string_view(dict[code]), buffer)));
+		}
+		return buffer_order[codes[row]];
+	}
+
+	std::unique_ptr<predicate> bind(const void *value, compare_t comp) const override
+	{
+		return std::make_unique<bound>(*this, *reinterpret_cast<const std::string *>(value), comp);
+	}
+
+	void delete_rows(const std::vector<std::size_t> &rows) override { erase_rows(codes, rows); }
+
+	index_base *generate_index(index_type type) override;
+
+	void *buff_from_str(std::string_view str) const override
+	{
+		buffer = str;
+		buffer_order.clear();
+		return &buffer;
+	}
+	void *buff_from_row(std::size_t row) const override { return const_cast<std::string *>(&dict[codes[row]]); }
+
+	void reserve(std::size_t N) override { codes.reserve(N); }
+	void append(const std::string_view *cells, std::size_t rows, std::size_t stride) override
+	{
+		for (std::size_t i = 0; i < rows; ++i)
+			codes.push_back(dict.intern(cells[i * stride]));
+	}
+	std::size_t size() const override { return codes.size(); }
+
+	// the dictionary in code order, laid out like a plain string column, then the codes
+	void save(snapshot_writer &out) const override
+	{
+		save_header(out, kind::dict);
+		string_arena strings;
+		for (std::uint32_t code = 0; code < dict.size(); ++code)
+			strings.push_back(dict[code]);
+		out.put(static_cast<std::uint64_t>(dict.size()));
+		strings.save(out);
+		out.segment(codes.data(), codes.size() * sizeof(codes[0]));
+	}
+
+	void load(snapshot_reader &in, std::size_t rows)
+	{
+		string_arena strings;
+		auto N = in.get<std::uint64_t>();
+		strings.load(in, N);
+		for (std::size_t code = 0; code < N; ++code)
+			dict.intern(strings[code]);
+		if (dict.size() != N)
+			throw std::runtime_error("snapshot is corrupt");
+
+		auto values = in.segment<std::uint32_t>(rows);
+		if (!std::all_of(values, values + rows, [N](std::uint32_t code)
+						 { return code < N; }))
+			throw std::runtime_error("snapshot is corrupt");
+		codes.assign(values, values + rows);
+	}
+
+	// falls back to plain strings once most values turn out to be distinct
+	column_base *reencode() override
+	{
+		if (!adaptive || codes.size() < sample_rows || dict.size() * 2 <= codes.size())
+			return nullptr;
+
+		auto res = new column<std::string>(name);
+		res->data.reserve(codes.size());
+		for (auto code : codes)
+			res->data.push_back(dict[code]);
+		return res;
+	}
+
+	std::vector<std::uint32_t> codes;
+	string_dictionary dict;
+
+private:
+	const int *code_data() const { return reinterpret_cast<const int *>(codes.data()); }
+
+	// equality compares codes with the int kernels, a missing string becomes -1 which no code matches;
+	// other comparisons check each dictionary entry once up front and then look rows up by code
+	class bound : public predicate
+	{
+	public:
+		bound(const dict_column &col, const std::string &str, compare_t comp) : col{col}, comp{comp}
+		{
+			if (comp == compare_t::equals)
+				code = static_cast<int>(col.dict.find(str));
+			else
+			{
+				matches.resize(col.dict.size());
+				for (std::uint32_t c = 0; c < col.dict.size(); ++c)
+					matches[c] = compare_3way(std::string_view(col.dict[c]), str) == static_cast<int>(comp);
+			}
+		}
+
+		std::size_t count(std::size_t first, std::size_t last) const override
+		{
+			if (comp == compare_t::equals)
+				return scan_kernels<int>::get().count_matching(col.code_data(), first, last, code, comp);
+
+			std::size_t res = 0;
+			for (std::size_t i = first; i < last; ++i)
+				res += matches[col.codes[i]];
+			return res;
+		}
+
+		void select(std::size_t first, std::size_t last, std::vector<std::size_t> &out) const override
+		{
+			std::size_t n = out.size();
+			out.resize(n + (last - first));
+			auto dst = out.data() + n;
+			if (comp == compare_t::equals)
+				n += scan_kernels<int>::get().select_matching(col.code_data(), first, last, code, comp, dst);
+			else
+			{
+				for (std::size_t i = first; i < last; ++i)
+				{
+					dst[0] = i;
+					dst += matches[col.codes[i]];
+				}
+				n = static_cast<std::size_t>(dst - out.data());
+			}
+			out.resize(n);
+		}
+
+		std::size_t filter(std::size_t *rows, std::size_t n) const override
+		{
+			std::size_t kept = 0;
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				auto c = col.codes[rows[i]];
+				rows[kept] = rows[i];
+				kept += comp == compare_t::equals ? static_cast<int>(c) == code : matches[c];
+			}
+			return kept;
+		}
+
+	private:
+		const dict_column &col;
+		compare_t comp;
+		int code = -1;
+		std::vector<unsigned char> matches;
+	};
+
+	mutable std::string buffer;
+	// compare_3way of each dictionary entry against buffer, filled in lazily
+	mutable std::vector<signed char> buffer_order;
+};
+
+template <typename T>
+column_base *column<T>::reencode()
+{
+	if constexpr (std::is_same_v<T, std::string>)
+	{
+		if (!adaptive || data.size() < dict_column::sample_rows)
+			return nullptr;
+		adaptive = false; // decide once
+
+		std::unordered_set<std::string_view> distinct;
+		for (std::size_t i = 0; i < data.size(); ++i)
+			distinct.insert(data[i]);
+		if (distinct.size() * 4 > data.size())
+			return nullptr;
+
+		auto res = new dict_column(name);
+		res->adaptive = true;
+		res->codes.reserve(data.size());
+		for (std::size_t i = 0; i < data.size(); ++i)
+			res->codes.push_back(res->dict.intern(data[i]));
+		return res;
+	}
+	else
+		return nullptr;
+}
+
+// a column save() wrote, with rows rows
+column_base *load_column(snapshot_reader &in, std::size_t rows)
+{
+	auto k = in.get<column_base::kind>();
+	std::string name(in.get_string());
+	bool adaptive = in.get<std::uint8_t>();
+
+	std::unique_ptr<column_base> res;
+	auto load = [&](auto *col)
+	{
+		res.reset(col);
+		col->load(in, rows);
+	};
+	switch (k)
+	{
+	case column_base::kind::integer:
+		load(new column<int>(name));
+		break;
+	case column_base::kind::real:
+		load(new column<double>(name));
+		break;
+	case column_base::kind::boolean:
+		load(new column<bool>(name));
+		break;
+	case column_base::kind::string:
+		load(new column<std::string>(name));
+		break;
+	case column_base::kind::dict:
+		load(new dict_column(name));
+		break;
+	default:
+		throw std::runtime_error("snapshot is corrupt");
+	}
+	res->adaptive = adaptive;
+	return res.release();
+}
+
+// equality lookups by dictionary code, a row list per code
+class dict_hash_index : public index_base
+{
+public:
+	dict_hash_index(dict_column *owner) : index_base(owner), col{owner}, needs_to_update{false}
+	{
+		update_map();
+	}
+
+	index_type type() const override { return index_type::hash; }
+
+	void update(bool do_update) override
+	{
+		needs_to_update = do_update;
+	}
+
+	void refresh() override
+	{
+		if (needs_to_update)
+		{
+			update_map();
+			needs_to_update = false;
+			++counters.index_rebuilds;
+		}
+	}
+
+	bool stale() const override { return needs_to_update; }
+
+	void append_rows(std::size_t first) override
+	{
+		if (first == col->codes.size())
+			return;
+
+		if (needs_to_update) // the rebuild sees the new rows as well
+		{
+			update_map();
+			needs_to_update = false;
+			++counters.index_rebuilds;
+			return;
+		}
+
+		add_rows(first);
+	}
+
+	void delete_rows(const std::vector<std::size_t> &deleted) override
+	{
+		if (deleted.empty() || needs_to_update) // a pending rebuild sees the delete anyway
+			return;
+
+		auto renumber = [this, &deleted](std::vector<std::size_t> &list)
+		{
+			bool had_rows = !list.empty();
+			shift_rows(list, deleted);
+			if (had_rows && list.empty())
+				--num_distinct;
+		};
+
+		// the lists holding rows from the first deleted one on are those of their codes, or all of them
+		std::size_t N = col->codes.size();
+		if (N - deleted.front() < num_distinct)
+		{
+			static std::vector<bool> seen;
+			seen.assign(rows.size(), false);
+			for (std::size_t r = deleted.front(); r < N; ++r)
+			{
+				auto code = col->codes[r];
+				if (!seen[code])
+				{
+					seen[code] = true;
+					renumber(rows[code]);
+				}
+			}
+		}
+		else
+		{
+			for (auto &list : rows)
+				renumber(list);
+		}
+	}
+
+	std::size_t distinct() const override { return num_distinct; }
+	std::size_t memory() const override
+	{
+		std::size_t bytes = rows.capacity() * sizeof(rows[0]);
+		for (auto &list : rows)
+			bytes += list.capacity() * sizeof(std::size_t);
+		return bytes;
+	}
+
+	void do_on_matching_rows(const void *value, compare_t comp, std::function<void(std::size_t)> func) override
+	{
+		for (auto i : get_matching_rows(value, comp))
+			func(i);
+	}
+
+	std::size_t count_matching(const void *value, compare_t comp) override
+	{
+		if (comp != compare_t::equals)
+			return ref->count_matching(value, comp);
+
+		refresh();
+		auto code = col->dict.find(*reinterpret_cast<const std::string *>(value));
+		return code < rows.size() ? rows[code].size() : 0;
+	}
+
+	const std::vector<std::size_t> &get_matching_rows(const void *value, compare_t comp) override
+	{
+		static std::vector<std::size_t> buffer;
+		buffer.clear();
+		if (comp == compare_t::equals)
+		{
+			refresh();
+
+			auto code = col->dict.find(*reinterpret_cast<const std::string *>(value));
+			if (code < rows.size())
+				return rows[code];
+			else
+				return buffer;
+		}
+		else
+		{
+			ref->select_matching(value, comp, buffer);
+			return buffer;
+		}
+	}
+
+	// a dictionary encoded probe column is translated into our codes once instead of per row
+	void join(const column_base &probe, const std::function<void(std::size_t, std::size_t)> &func) override
+	{
+		auto probe_dict = dynamic_cast<const dict_column *>(&probe);
+		if (!probe_dict)
+			return index_base::join(probe, func);
+
+		refresh();
+
+		std::vector<std::uint32_t> translated(probe_dict->dict.size());
+		for (std::uint32_t code = 0; code < translated.size(); ++code)
+			translated[code] = col->dict.find(probe_dict->dict[code]);
+
+		for (std::size_t i1 = 0; i1 < probe_dict->codes.size(); ++i1)
+		{
+			auto code = translated[probe_dict->codes[i1]];
+			if (code < rows.size())
+				for (auto i2 : rows[code])
+					func(i1, i2);
+		}
+	}
+
+	// the row count of each of our codes, summed up over the probe's codes
+	std::size_t count_join(const column_base &probe) override
+	{
+		auto probe_dict = dynamic_cast<const dict_column *>(&probe);
+		if (!probe_dict)
+			return index_base::count_join(probe);
+
+		refresh();
+
+		std::vector<std::size_t> per_code(probe_dict->dict.size(), 0);
+		for (std::uint32_t code = 0; code < per_code.size(); ++code)
+		{
+			auto ours = col->dict.find(probe_dict->dict[code]);
+			if (ours < rows.size())
+				per_code[code] = rows[ours].size();
+		}
+
+		std::size_t n = 0;
+		for (auto code : probe_dict->codes)
+			n += per_code[code];
+		return n;
+	}
+
+private:
+	std::vector<std::vector<std::size_t>> rows;
+	std::size_t num_distinct = 0;
+	dict_column *col;
+	bool needs_to_update;
+
+	void add_rows(std::size_t first)
+	{
+		if (rows.size() < col->dict.size())
+			rows.resize(col->dict.size());
+		for (std::size_t i = first; i < col->codes.size(); ++i)
+		{
+			auto &list = rows[col->codes[i]];
+			if (list.empty())
+				++num_distinct;
+			list.push_back(i);
+		}
+	}
+
+	void update_map()
+	{
+		rows.clear();
+		num_distinct = 0;
+		add_rows(0);
+	}
+};
+
+// ordered lookups over a dictionary column, keyed by views of the dictionary strings
+class dict_bst_index : public index_base
+{
+public:
+	dict_bst_index(dict_column *owner) : index_base(owner), col{owner}, needs_to_update{false}
+	{
+		update_map();
+	}
+
+	index_type type() const override { return index_type::bst; }
+
+	void update(bool do_update) override
+	{
+		needs_to_update = do_update;
+	}
+
+	void refresh() override
+	{
+		if (needs_to_update)
+		{
+			update_map();
+			needs_to_update = false;
+			++counters.index_rebuilds;
+		}
+	}
+
+	bool stale() const override { return needs_to_update; }
+
+	void append_rows(std::size_t first) override
+	{
+		if (first == col->codes.size())
+			return;
+
+		if (needs_to_update) // the rebuild sees the new rows as well
+		{
+			update_map();
+			needs_to_update = false;
+			++counters.index_rebuilds;
+			return;
+		}
+
+		for (std::size_t i = first; i < col->codes.size(); ++i)
+			runs.add(key(i), i);
+	}
+
+	void delete_rows(const std::vector<std::size_t> &rows) override
+	{
+		if (rows.empty() || needs_to_update) // a pending rebuild sees the delete anyway
+			return;
+
+		runs.erase(rows);
+	}
+
+	std::size_t distinct() const override { return runs.distinct(); }
+	std::size_t memory() const override { return runs.memory(); }
+
+	void do_on_matching_rows(const void *value, compare_t comp, std::function<void(std::size_t)> func) override
+	{
+		refresh();
+		runs.for_each_matching(std::string_view(*reinterpret_cast<const std::string *>(value)), comp, func);
+	}
+
+	std::size_t count_matching(const void *value, compare_t comp) override
+	{
+		refresh();
+		return runs.count_matching(std::string_view(*reinterpret_cast<const std::string *>(value)), comp);
+	}
+
+	const std::vector<std::size_t> &get_matching_rows(const void *value, compare_t comp) override
+	{
+		static std::vector<std::size_t> buffer;
+		buffer.clear();
+		refresh();
+		runs.select(std::string_view(*reinterpret_cast<const std::string *>(value)), comp, col->codes.size(), buffer);
+		return buffer;
+	}
+
+	// the keys and their rows in key order, with nothing pending
+	const sorted_runs<std::string_view> &entries()
+	{
+		refresh();
+		runs.fold();
+		return runs;
+	}
+
+private:
+	sorted_runs<std::string_view> runs;
+	dict_column *col;
+	bool needs_to_update;
+
+	std::string_view key(std::size_t row) const { return col->dict[col->codes[row]]; }
+
+	void update_map()
+	{
+		runs.build(col->codes.size(), [this](std::size_t row)
+				   { return key(row); });
+	}
+};
+
+index_base *dict_column::generate_index(index_type type)
+{
+	if (type == index_type::bst)
+		return new dict_bst_index(this);
+	else
+		return new dict_hash_index(this);
+}
+
+template <typename T>
+index_base *column<T>::generate_index(index_type type)
+{
+	if (type == index_type::bst)
+	{
+		auto res = new bst_index<T>(this);
+		return res;
+	}
+	else
+	{
+		auto res = new hash_index<T>(this);
+		return res;
+	}
+}
+
+// a fixed set of threads that run batches of numbered tasks, the calling thread joins in
+class worker_pool
+{
+public:
+	worker_pool(std::size_t threads)
+	{
+		for (std::size_t i = 1; i < threads; ++i)
+			workers.emplace_back([this]() { work(); });
+	}
+
+	worker_pool(const worker_pool &) = delete;
+	worker_pool &operator=(const worker_pool &) = delete;
+
+	~worker_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto &worker : workers)
+			worker.join();
+	}
+
+	std::size_t size() const { return workers.size() + 1; }
+
+	// calls task(0) .. task(N - 1), in no particular order or thread, and returns once all are done
+	void run(std::size_t N, const std::function<void(std::size_t)> &task)
+	{
+		if (workers.empty() || N <= 1)
+		{
+			for (std::size_t i = 0; i < N; ++i)
+				task(i);
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		job = &task;
+		job_size = N;
+		next = 0;
+		pending = N;
+		wake.notify_all();
+
+		while (next < job_size)
+			run_next(lock);
+		done.wait(lock, [this]() { return pending == 0; });
+		job = nullptr;
+		job_size = 0;
+	}
+
+private:
+	void work()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;)
+		{
+			wake.wait(lock, [this]() { return stopping || next < job_size; });
+			if (stopping)
+				return;
+			run_next(lock);
+		}
+	}
+
+	// takes the next task of the current job and runs it unlocked
+	void run_next(std::unique_lock<std::mutex> &lock)
+	{
+		auto i = next++;
+		auto &task = *job;
+		lock.unlock();
+		task(i);
+		lock.lock();
+		if (--pending == 0)
+			done.notify_all();
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	const std::function<void(std::size_t)> *job = nullptr;
+	std::size_t job_size = 0, next = 0, pending = 0;
+	bool stopping = false;
+};
+
+// rows per scan task, big enough to keep the threads busy but small enough to spread the work
+constexpr std::size_t morsel_rows = std::size_t{1} << 16;
+
+// pred.count(0, N) split into morsels across the pool
+std::size_t count_rows(worker_pool &pool, const predicate &pred, std::size_t N)
+{
+	counters.rows_scanned += N;
+	std::size_t morsels = (N + morsel_rows - 1) / morsel_rows;
+	if (pool.size() == 1 || morsels <= 1)
+		return pred.count(0, N);
+
+	std::vector<std::size_t> counts(morsels);
+	pool.run(morsels, [&](std::size_t m)
+			 { counts[m] = pred.count(m * morsel_rows, std::min(N, (m + 1) * morsel_rows)); });
+
+	std::size_t res = 0;
+	for (auto n : counts)
+		res += n;
+	return res;
+}
+
+// pred.select(0, N, out) split into morsels across the pool, each morsel selects into its own
+// vector and those are copied out back to back, so the rows still come out in row order
+void select_rows(worker_pool &pool, const predicate &pred, std::size_t N, std::vector<std::size_t> &out)
+{
+	counters.rows_scanned += N;
+	std::size_t morsels = (N + morsel_rows - 1) / morsel_rows;
+	if (pool.size() == 1 || morsels <= 1)
+		return pred.select(0, N, out);
+
+	static std::vector<std::vector<std::size_t>> parts;
+	static std::vector<std::size_t> starts;
+	if (parts.size() < morsels)
+		parts.resize(morsels);
+	pool.run(morsels, [&](std::size_t m)
+			 {
+				 parts[m].clear();
+				 pred.select(m * morsel_rows, std::min(N, (m + 1) * morsel_rows), parts[m]); });
+
+	starts.resize(morsels);
+	std::size_t total = out.size();
+	for (std::size_t m = 0; m < morsels; ++m)
+	{
+		starts[m] = total;
+		total += parts[m].size();
+	}
+	out.resize(total);
+	pool.run(morsels, [&](std::size_t m)
+			 { std::copy(parts[m].begin(), parts[m].end(), out.begin() + static_cast<std::ptrdiff_t>(starts[m])); });
+}
+
+// pred.filter over rows split into morsels across the pool, each morsel keeps its matches at its
+// front and those are then moved together, so rows keeps its order
+void filter_rows(worker_pool &pool, const predicate &pred, std::vector<std::size_t> &rows)
+{
+	std::size_t N = rows.size(), morsels = (N + morsel_rows - 1) / morsel_rows;
+	counters.rows_scanned += N;
+	if (pool.size() == 1 || morsels <= 1)
+		return rows.resize(pred.filter(rows.data(), N));
+
+	std::vector<std::size_t> kept(morsels);
+	pool.run(morsels, [&](std::size_t m)
+			 {
+				 std::size_t first = m * morsel_rows;
+				 kept[m] = pred.filter(rows.data() + first, std::min(N, first + morsel_rows) - first); });
+
+	std::size_t total = kept[0];
+	for (std::size_t m = 1; m < morsels; ++m)
+	{
+		auto first = rows.begin() + static_cast<std::ptrdiff_t>(m * morsel_rows);
+		std::copy(first, first + static_cast<std::ptrdiff_t>(kept[m]), rows.begin() + static_cast<std::ptrdiff_t>(total));
+		total += kept[m];
+	}
+	rows.resize(total);
+}
+
+// the join key of each row of a plain column, strings as views so they compare across encodings
+template <typename T>
+class column_keys
+{
+public:
+	using key_type = std::conditional_t<std::is_same_v<T, std::string>, std::string_view, T>;
+	// mix_hash is a bijection, so equal hashes of ints and bools mean equal keys; doubles still
+	// need the compare for NaN
+	static constexpr bool exact_hash = std::is_same_v<T, int> || std::is_same_v<T, bool>;
+
+	column_keys(const column<T> &col) : col{col} {}
+
+	std::size_t size() const { return col.data.size(); }
+	key_type key(std::size_t row) const { return col.data[row]; }
+
+	std::uint64_t hash(std::size_t row) const { return hash_key(key(row)); }
+
+private:
+	const column<T> &col;
+};
+
+// join keys of a dictionary column, each dictionary entry is hashed once
+class dict_keys
+{
+public:
+	using key_type = std::string_view;
+	static constexpr bool exact_hash = false;
+
+	dict_keys(const dict_column &col) : col{col}, hashes(col.dict.size())
+	{
+		for (std::uint32_t code = 0; code < col.dict.size(); ++code)
+			hashes[code] = hash_key(std::string_view(col.dict[code]));
+	}
+
+	std::size_t size() const { return col.codes.size(); }
+	key_type key(std::size_t row) const { return col.dict[col.codes[row]]; }
+	std::uint64_t hash(std::size_t row) const { return hashes[col.codes[row]]; }
+
+private:
+	const dict_column &col;
+	std::vector<std::uint64_t> hashes;
+};
+
+// calls f with the join keys of col, does nothing for columns that have none
+template <typename F>
+void with_join_keys(const column_base &col, F f)
+{
+	if (auto c = dynamic_cast<const column<int> *>(&col))
+		f(column_keys<int>(*c));
+	else if (auto c = dynamic_cast<const column<double> *>(&col))
+		f(column_keys<double>(*c));
+	else if (auto c = dynamic_cast<const column<bool> *>(&col))
+		f(column_keys<bool>(*c));
+	else if (auto c = dynamic_cast<const column<std::string> *>(&col))
+		f(column_keys<std::string>(*c));
+	else if (auto c = dynamic_cast<const dict_column *>(&col))
+		f(dict_keys(*c));
+}
+
+// build side of a radix partitioned hash join: rows are scattered by the top bits of their key hash
+// into partitions small enough to stay in cache, and each partition gets its own chained table
+// whose chains list rows in ascending order
+template <typename Keys>
+class join_build
+{
+public:
+	join_build(const Keys &keys, worker_pool &pool) : keys{keys}
+	{
+		std::size_t N = keys.size();
+		while (bits < 10 && (N >> bits) > partition_rows)
+			++bits;
+		std::size_t P = std::size_t{1} << bits;
+		std::size_t morsels = std::max<std::size_t>(1, (N + morsel_rows - 1) / morsel_rows);
+
+		// hash once and count per morsel and partition, so the scatter below is parallel and stable
+		std::vector<std::uint64_t> row_hashes(N);
+		std::vector<std::size_t> pos(morsels * P);
+		pool.run(morsels, [&](std::size_t m)
+				 {
+					 for (std::size_t i = m * morsel_rows; i < std::min(N, (m + 1) * morsel_rows); ++i)
+					 {
+						 row_hashes[i] = keys.hash(i);
+						 ++pos[m * P + partition(row_hashes[i])];
+					 } });
+
+		part_begin.resize(P + 1);
+		std::size_t sum = 0;
+		for (std::size_t p = 0; p < P; ++p)
+		{
+			part_begin[p] = sum;
+			for (std::size_t m = 0; m < morsels; ++m)
+			{
+				auto n = pos[m * P + p];
+				pos[m * P + p] = sum;
+				sum += n;
+			}
+			if (sum - part_begin[p] >= std::numeric_limits<std::uint32_t>::max())
+				throw std::length_error("join partition is too large");
+		}
+		part_begin[P] = sum;
+
+		entries.resize(N);
+		pool.run(morsels, [&](std::size_t m)
+				 {
+					 for (std::size_t i = m * morsel_rows; i < std::min(N, (m + 1) * morsel_rows); ++i)
+					 {
+						 entries[pos[m * P + partition(row_hashes[i])]++] = {row_hashes[i], i};
+					 } });
+
+		bucket_begin.resize(P + 1);
+		sum = 0;
+		for (std::size_t p = 0; p < P; ++p)
+		{
+			bucket_begin[p] = sum;
+			std::size_t buckets = 1;
+			while (buckets < part_begin[p + 1] - part_begin[p])
+				buckets *= 2;
+			sum += buckets;
+		}
+		bucket_begin[P] = sum;
+
+		// entries are pushed onto their chain back to front, so chains come out in row order
+		heads.assign(sum, 0);
+		next.resize(N);
+		pool.run(P, [&](std::size_t p)
+				 {
+					 auto first = part_begin[p], mask = bucket_begin[p + 1] - bucket_begin[p] - 1;
+					 for (auto e = part_begin[p + 1]; e-- > first;)
+					 {
+						 auto &head = heads[bucket_begin[p] + (entries[e].hash & mask)];
+						 next[e] = head;
+						 head = static_cast<std::uint32_t>(e - first + 1);
+					 } });
+	}
+
+	// calls emit(probe_row, build_row) for every pair of equal keys with probe_row in [first, last),
+	// in probe row order and then build row order; probe hashes are computed a batch at a time
+	template <typename ProbeKeys, typename Emit>
+	void probe(const ProbeKeys &probe_keys, std::size_t first, std::size_t last, Emit emit) const
+	{
+		constexpr std::size_t batch = 256;
+		std::uint64_t h[batch];
+		for (std::size_t i = first; i < last; i += batch)
+		{
+			std::size_t n = std::min(batch, last - i);
+			for (std::size_t k = 0; k < n; ++k)
+				h[k] = probe_keys.hash(i + k);
+
+			for (std::size_t k = 0; k < n; ++k)
+			{
+				auto p = partition(h[k]);
+				auto base = part_begin[p] - 1, mask = bucket_begin[p + 1] - bucket_begin[p] - 1;
+				for (auto e = heads[bucket_begin[p] + (h[k] & mask)]; e; e = next[base + e])
+				{
+					auto &entry = entries[base + e];
+					if (entry.hash == h[k] && (Keys::exact_hash || keys.key(entry.row) == probe_keys.key(i + k)))
+						emit(i + k, entry.row);
+				}
+			}
+		}
+	}
+
+private:
+	// build rows per partition the partition count aims for
+	static constexpr std::size_t partition_rows = 4096;
+
+	std::size_t partition(std::uint64_t h) const { return bits ? static_cast<std::size_t>(h >> (64 - bits)) : 0; }
+
+	const Keys &keys;
+	unsigned bits = 0;
+	// partition p holds entries [part_begin[p], part_begin[p + 1]) and buckets [bucket_begin[p], bucket_begin[p + 1])
+	std::vector<std::size_t> part_begin, bucket_begin;
+	struct entry
+	{
+		std::uint64_t hash;
+		std::size_t row;
+	};
+	std::vector<entry> entries;
+	// 1 + entry within the partition, 0 ends a chain
+	std::vector<std::uint32_t> heads, next;
+};
+
+using join_pairs = std::vector<std::pair<std::size_t, std::size_t>>;
+
+// calls out(i1, i2) for the M (i1, i2) pairs in parts, which come in i2 order, ordered by i1 and
+// then i2 with a stable counting sort on i1; frees the parts as it goes
+template <typename Out>
+void stitch_by_first(std::vector<join_pairs> &parts, std::size_t N1, std::size_t M, Out out)
+{
+	std::vector<std::size_t> start(N1 + 1), sorted(M);
+	for (auto &part : parts)
+		for (auto &match : part)
+			++start[match.first + 1];
+	for (std::size_t i1 = 0; i1 < N1; ++i1)
+		start[i1 + 1] += start[i1];
+	for (auto &part : parts)
+	{
+		for (auto &match : part)
+			sorted[start[match.first]++] = match.second;
+		join_pairs().swap(part);
+	}
+
+	for (std::size_t i1 = 0, k = 0; i1 < N1; ++i1)
+		for (; k < start[i1]; ++k)
+			out(i1, sorted[k]);
+}
+
+// equi-join of two key sets, building on the smaller one; calls out(i1, i2) for every match ordered
+// by i1 and then i2, unless count_only, and returns the number of matches
+template <typename Keys1, typename Keys2, typename Out>
+std::size_t hash_join(const Keys1 &keys1, const Keys2 &keys2, worker_pool &pool, bool count_only, Out out)
+{
+	std::size_t N1 = keys1.size(), N2 = keys2.size();
+	std::size_t num_matching = 0;
+	counters.rows_scanned += N1 + N2;
+	counters.join_probes += std::max(N1, N2);
+
+	if (N2 <= N1)
+	{
+		// probing with t1 already yields the output order, the morsels are stitched back in order
+		// a few at a time so the pairs waiting to be written stay bounded
+		join_build<Keys2> build(keys2, pool);
+		std::size_t morsels = (N1 + morsel_rows - 1) / morsel_rows, wave = 4 * pool.size();
+		std::vector<join_pairs> parts(std::min(morsels, wave));
+		std::vector<std::size_t> counts(morsels);
+		for (std::size_t w = 0; w < morsels; w += wave)
+		{
+			std::size_t n = std::min(wave, morsels - w);
+			pool.run(n, [&](std::size_t k)
+					 {
+						 std::size_t first = (w + k) * morsel_rows, last = std::min(N1, first + morsel_rows);
+						 if (count_only)
+							 build.probe(keys1, first, last, [&](std::size_t, std::size_t) { ++counts[w + k]; });
+						 else
+						 {
+							 parts[k].clear();
+							 build.probe(keys1, first, last, [&](std::size_t i1, std::size_t i2) { parts[k].emplace_back(i1, i2); });
+							 counts[w + k] = parts[k].size();
+						 } });
+
+			for (std::size_t k = 0; k < n && !count_only; ++k)
+				for (auto &match : parts[k])
+					out(match.first, match.second);
+		}
+
+		for (auto n : counts)
+			num_matching += n;
+	}
+	else
+	{
+		// probing with t2 finds the pairs in i2 order, a stable counting sort on i1 restores the
+		// output order
+		join_build<Keys1> build(keys1, pool);
+		std::size_t morsels = (N2 + morsel_rows - 1) / morsel_rows;
+		std::vector<join_pairs> parts(count_only ? 0 : morsels);
+		std::vector<std::size_t> counts(morsels);
+		pool.run(morsels, [&](std::size_t m)
+				 {
+					 std::size_t first = m * morsel_rows, last = std::min(N2, first + morsel_rows);
+					 if (count_only)
+						 build.probe(keys2, first, last, [&](std::size_t, std::size_t) { ++counts[m]; });
+					 else
+					 {
+						 build.probe(keys2, first, last, [&](std::size_t i2, std::size_t i1) { parts[m].emplace_back(i1, i2); });
+						 counts[m] = parts[m].size();
+					 } });
+
+		for (auto n : counts)
+			num_matching += n;
+		if (!count_only)
+			stitch_by_first(parts, N1, num_matching, out);
+	}
+
+	return num_matching;
+}
+
+// calls f with the key-ordered rows of a tree index, does nothing for other indexes
+template <typename F>
+void with_key_order(index_base *index, F f)
+{
+	if (auto i = dynamic_cast<bst_index<int> *>(index))
+		f(i->entries());
+	else if (auto i = dynamic_cast<bst_index<double> *>(index))
+		f(i->entries());
+	else if (auto i = dynamic_cast<bst_index<bool> *>(index))
+		f(i->entries());
+	else if (auto i = dynamic_cast<bst_index<std::string> *>(index))
+		f(i->entries());
+	else if (auto i = dynamic_cast<dict_bst_index *>(index))
+		f(i->entries());
+}
+
+// walks two key-ordered indexes together, calls f(k1, k2) with the positions of each key found in both;
+// NaN keys sort last on both sides and equal nothing, so the walk ends where they start
+template <typename Runs1, typename Runs2, typename F>
+void merge_join(const Runs1 &runs1, const Runs2 &runs2, F f)
+{
+	std::size_t k1 = 0, k2 = 0;
+	while (k1 < runs1.size() && k2 < runs2.size())
+	{
+		if (key_less(runs1.key(k1), runs2.key(k2)))
+			k1 = runs1.skip_to(k1, runs2.key(k2));
+		else if (key_less(runs2.key(k2), runs1.key(k1)))
+			k2 = runs2.skip_to(k2, runs1.key(k1));
+		else if (is_nan_key(runs1.key(k1)))
+			break;
+		else
+			f(k1++, k2++);
+	}
+}
+
+// what JOIN knows about one side before it picks a strategy
+struct join_side
+{
+	std::size_t rows;
+	// the table's indexes on the join column, nullptr where there is none
+	index_base *hash, *tree;
+
+	// the index to probe, hash lookups being the cheaper
+	index_base *index() const { return hash ? hash : tree; }
+
+	// distinct keys, from an index when there is one (it may be a little stale, which is fine
+	// for an estimate), otherwise assumed unique
+	double distinct() const { return index() ? static_cast<double>(std::max<std::size_t>(1, index()->distinct())) : static_cast<double>(std::max<std::size_t>(1, rows)); }
+};
+
+enum class join_plan
+{
+	hash_join,    // partitioned hash join built on the smaller side
+	probe_index1, // each t2 row probes t1's index, the matches are sorted back into t1 order
+	probe_index2, // each t1 row probes t2's index
+	merge_indexes, // both columns have tree indexes, walked together in key order
+};
+
+// picks the plan with the lowest estimated cost, counted in the rows the hash join handles per
+// unit of time: it reads both sides once, an existing index saves the build but each probe through
+// it costs several of those rows, and matches found in t2 or key order pay for a sort into t1 order
+join_plan plan_join(const join_side &s1, const join_side &s2, bool count_only)
+{
+	auto N1 = static_cast<double>(s1.rows), N2 = static_cast<double>(s2.rows);
+	double matches = N1 * N2 / std::max(s1.distinct(), s2.distinct());
+
+	// measured on 1M row int and string joins: a hash index probe costs 1-3 hash join rows, a tree
+	// probe misses the cache about once per level
+	auto probe_cost = [](const index_base *index)
+	{
+		if (index->type() == index_type::hash)
+			return 2.0;
+		return 1.0 + 0.75 * std::log2(static_cast<double>(index->distinct()) + 1);
+	};
+
+	join_plan plan = join_plan::hash_join;
+	double best = N1 + N2 + (N1 < N2 ? matches : 0);
+	if (s2.index() && probe_cost(s2.index()) * N1 < best)
+	{
+		plan = join_plan::probe_index2;
+		best = probe_cost(s2.index()) * N1;
+	}
+	if (s1.index() && probe_cost(s1.index()) * N2 + matches < best)
+	{
+		plan = join_plan::probe_index1;
+		best = probe_cost(s1.index()) * N2 + matches;
+	}
+	// walking a tree costs about two hash join rows per node, and counting needs no matches at all
+	if (s1.tree && s2.tree &&
+		2 * (s1.distinct() + s2.distinct()) + (count_only ? 0 : matches) < best)
+		plan = join_plan::merge_indexes;
+	return plan;
+}
+
+// one column op value condition of a WHERE clause
+struct where_term
+{
+	std::string column;
+	compare_t comp;
+	std::string value;
+};
+
+// the conditions of a WHERE clause: the terms of each group are ANDed and the groups ORed, AND
+// binding tighter
+using where_clause = std::vector<std::vector<where_term>>;
+
+// the rows PRINT or JOIN printed, handed back for the result cache: row ids in print order, JOIN's
+// as i1, i2 pairs one after the other; complete turns false once there are more than limit ids
+struct kept_rows
+{
+	std::size_t limit = 0;
+	std::vector<std::size_t> ids;
+	bool complete = true;
+
+	void add(std::size_t id)
+	{
+		if (ids.size() < limit)
+			ids.push_back(id);
+		else
+			complete = false;
+	}
+
+	void assign(const std::vector<std::size_t> &rows)
+	{
+		if (rows.size() <= limit)
+			ids.assign(rows.begin(), rows.end());
+		else
+			complete = false;
+	}
+};
+
+class table
+{
+public:
+	table() = default;
+
+	std::size_t generate_index(index_type type, const std::string &column)
+	{
+		auto it = m_column_hash.find(column);
+		if (it == m_column_hash.end())
+			throw std::runtime_error("column not found");
+
+		auto col = m_columns[it->second];
+
+		// a new index shouldn't pick up dead rows, and the key count shouldn't include them
+		compact();
+
+		if (auto index = find_index(col, type)) // if already exists there
+			return index->distinct();
+
+		// a new index can change the order PRINT finds rows in
+		m_version = next_version();
+		m_indexes.push_back(col->generate_index(type));
+
+		return m_indexes.back()->distinct();
+	}
+
+	// the index on col of the given type, nullptr if there is none
+	index_base *find_index(const column_base *col, index_type type) const
+	{
+		for (auto *index : m_indexes)
+			if (index->ref == col && index->type() == type)
+				return index;
+		return nullptr;
+	}
+
+	// the index to answer compare(col, value) == comp with: a hash index for equality, else a tree;
+	// nullptr to scan the column, a hash index has no order and a range on it is a scan anyway
+	index_base *pick_index(const column_base *col, compare_t comp) const
+	{
+		if (comp == compare_t::equals)
+			if (auto index = find_index(col, index_type::hash))
+				return index;
+		return find_index(col, index_type::bst);
+	}
+
+	// prints each index with its key count and rough heap use, returns the total bytes
+	std::size_t print_indexes() const
+	{
+		std::size_t total = 0;
+		for (auto *index : m_indexes)
+		{
+			auto bytes = index->memory();
+			std::cout << (index->type() == index_type::bst ? "bst" : "hash") << " index on column " << index->ref->name
+					  << ", with " << index->distinct() << " distinct keys, using " << bytes << " bytes\n";
+			total += bytes;
+		}
+		return total;
+	}
+
+	std::size_t num_indexes() const { return m_indexes.size(); }
+
+	// returns number of matching rows found, keep gets the printed rows
+	std::size_t print(const std::vector<std::string> &columns, const where_clause &where, bool quiet, worker_pool &pool, kept_rows *keep = nullptr) const
+	{
+		if (quiet && where.size() == 1 && where[0].size() == 1)
+			return count_matching(where[0][0], pool);
+
+		static std::vector<std::size_t> rows;
+		select_where(where, false, pool, rows);
+		if (!quiet)
+			write_rows(resolve(columns), columns, rows, pool);
+		if (keep && !quiet)
+			keep->assign(rows);
+		return rows.size();
+	}
+
+	// PRINT's output for rows print kept earlier
+	void print_rows(const std::vector<std::string> &columns, const std::vector<std::size_t> &rows, worker_pool &pool) const
+	{
+		write_rows(resolve(columns), columns, rows, pool);
+	}
+
+	// prints all rows
+	void print(const std::vector<std::string> &columns, worker_pool &pool) const
+	{
+		static std::vector<std::size_t> rows;
+		rows.resize(stored_rows());
+		for (std::size_t i = 0; i < rows.size(); ++i)
+			rows[i] = i;
+		drop_dead(rows);
+		counters.rows_scanned += rows.size();
+
+		write_rows(resolve(columns), columns, rows, pool);
+	}
+
+	// with compact_at > 0 the rows are only marked dead, and the table is compacted once more than
+	// that fraction of its rows are
+	std::size_t delete_rows(const where_clause &where, worker_pool &pool, double compact_at)
+	{
+		static std::vector<std::size_t> rows;
+		select_where(where, true, pool, rows);
+		if (!rows.empty())
+			m_version = next_version();
+
+		if (compact_at <= 0)
+			drop_rows(rows);
+		else
+		{
+			m_dead.resize(stored_rows());
+			for (auto row : rows)
+				m_dead.set(row);
+			m_num_dead += rows.size();
+			if (static_cast<double>(m_num_dead) > compact_at * static_cast<double>(stored_rows()))
+				compact();
+		}
+
+		return rows.size();
+	}
+
+	// writes the live rows as a snapshot named name, with which indexes there are; LOAD rebuilds them
+	void save(const std::string &name, const std::string &path)
+	{
+		compact();
+
+		snapshot_writer out(path);
+		out.put(snapshot_magic);
+		out.put(snapshot_version);
+		out.put_string(name);
+		out.put(static_cast<std::uint64_t>(stored_rows()));
+		out.put(static_cast<std::uint64_t>(m_columns.size()));
+		for (auto *col : m_columns)
+			col->save(out);
+
+		out.put(static_cast<std::uint64_t>(m_indexes.size()));
+		for (auto *index : m_indexes)
+		{
+			auto col = std::find(m_columns.begin(), m_columns.end(), index->ref) - m_columns.begin();
+			out.put(static_cast<std::uint64_t>(col));
+			out.put(static_cast<std::uint8_t>(index->type() == index_type::hash));
+		}
+		out.close();
+	}
+
+	// fills this new table from a snapshot whose name was just read
+	void load(snapshot_reader &in)
+	{
+		// every column takes a byte of header and at least a bit per row
+		auto rows = in.get<std::uint64_t>();
+		auto N = in.get<std::uint64_t>();
+		if (N > in.remaining() || rows / 8 > in.remaining())
+			throw std::runtime_error("snapshot is corrupt");
+		reserve_columns(N);
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			m_columns.push_back(load_column(in, rows));
+			if (!m_column_hash.emplace(m_columns.back()->name, i).second)
+				throw std::runtime_error("snapshot is corrupt");
+		}
+
+		auto M = in.get<std::uint64_t>();
+		for (std::size_t i = 0; i < M; ++i)
+		{
+			auto col = in.get<std::uint64_t>();
+			auto type = in.get<std::uint8_t>() ? index_type::hash : index_type::bst;
+			if (col >= N)
+				throw std::runtime_error("snapshot is corrupt");
+			generate_index(type, m_columns[col]->name);
+		}
+	}
+
+	// drops the rows DELETE marked dead for good
+	void compact()
+	{
+		if (m_num_dead == 0)
+			return;
+
+		drop_rows(dead_rows());
+		m_dead.clear();
+		m_num_dead = 0;
+		m_version = next_version();
+	}
+
+	bool is_dead(std::size_t row) const { return m_num_dead && row < m_dead.size() && m_dead[row]; }
+
+	bool contains_column(const std::string &column) const
+	{
+		return m_column_hash.find(column) != m_column_hash.end();
+	}
+
+	void reserve_columns(std::size_t N) { m_columns.reserve(N); }
+
+	template <typename T>
+	void add_column(const std::string &colname, bool adaptive = false)
+	{
+		m_columns.push_back(new column<T>(colname));
+		m_columns.back()->adaptive = adaptive;
+		m_column_hash[colname] = m_columns.size() - 1;
+	}
+
+	void add_dict_column(const std::string &colname)
+	{
+		m_columns.push_back(new dict_column(colname));
+		m_column_hash[colname] = m_columns.size() - 1;
+	}
+
+	// the column types CREATE takes
+	static bool is_column_type(std::string_view type)
+	{
+		return type == "int" || type == "double" || type == "bool" || type == "string" || type == "string:dict" || type == "string:plain";
+	}
+
+	// adds a column of a type is_column_type accepts
+	void add_typed_column(std::string_view type, const std::string &colname)
+	{
+		if (type == "int")
+			add_column<int>(colname);
+		else if (type == "double")
+			add_column<double>(colname);
+		else if (type == "bool")
+			add_column<bool>(colname);
+		else if (type == "string")
+			add_column<std::string>(colname, true);
+		else if (type == "string:dict")
+			add_dict_column(colname);
+		else if (type == "string:plain")
+			add_column<std::string>(colname);
+		else
+			throw std::runtime_error("unknown type");
+	}
+
+	const std::vector<column_base *> &get_columns() const
+	{
+		return m_columns;
+	}
+
+	std::size_t num_cols() const { return m_columns.size(); }
+	// rows not deleted
+	std::size_t num_rows() const { return stored_rows() - m_num_dead; }
+	// rows in the columns, dead ones included; row ids run up to this
+	std::size_t stored_rows() const
+	{
+		if (m_columns.empty())
+			return 0;
+		else
+			return m_columns[0]->size();
+	}
+
+	// bulk INSERT: reserve_rows once, append_rows per batch, then finish_insert from the first new
+	// row, which is at stored_rows() before the insert
+	void reserve_rows(std::size_t N)
+	{
+		for (auto *col : m_columns)
+			col->reserve(N);
+	}
+
+	// cells are row-major, num_cols() per row
+	void append_rows(const std::string_view *cells, std::size_t rows)
+	{
+		for (std::size_t i = 0; i < m_columns.size(); ++i)
+			m_columns[i]->append(cells + i, rows, m_columns.size());
+	}
+
+	void finish_insert(std::size_t first)
+	{
+		m_version = next_version();
+		for (auto *index : m_indexes)
+			index->append_rows(first);
+
+		for (auto &col : m_columns)
+		{
+			auto res = col->reencode();
+			if (!res)
+				continue;
+
+			for (auto &index : m_indexes)
+			{
+				if (index->ref != col)
+					continue;
+				auto type = index->type();
+				delete index;
+				index = res->generate_index(type);
+			}
+
+			delete col;
+			col = res;
+		}
+	}
+
+	~table()
+	{
+		for (auto index : m_indexes)
+			delete index;
+		for (auto column : m_columns)
+			delete column;
+	}
+
+	// joins on two tree indexes by walking them in key order, the matches are sorted back into t1
+	// order; counting needs no more than the sizes of each key's row lists
+	template <typename Out>
+	static std::size_t merge_indexes(index_base &index1, index_base &index2, std::size_t N1, bool count_only, Out out)
+	{
+		std::size_t num_matching = 0;
+		std::vector<join_pairs> found(1);
+		with_key_order(&index1, [&](const auto &runs1)
+					   { with_key_order(&index2, [&](const auto &runs2)
+										{
+											using Runs1 = std::decay_t<decltype(runs1)>;
+											using Runs2 = std::decay_t<decltype(runs2)>;
+											if constexpr (std::is_same_v<typename Runs1::view_type, typename Runs2::view_type>)
+												merge_join(runs1, runs2, [&](std::size_t k1, std::size_t k2)
+														   {
+															   num_matching += runs1.count(k1) * runs2.count(k2);
+															   if (!count_only)
+																   runs1.for_each_row(k1, [&](std::size_t i1)
+																					  { runs2.for_each_row(k2, [&](std::size_t i2)
+																										   { found[0].emplace_back(i1, i2); }); });
+														   }); }); });
+
+		if (!count_only)
+			stitch_by_first(found, N1, num_matching, out);
+		return num_matching;
+	}
+
+	// keep gets the printed pairs
+	static std::size_t join(const table &t1, const table &t2,
+							const std::string &colname1, const std::string &colname2,
+							const std::vector<std::string> &columns, const std::vector<std::size_t> &which,
+							bool quiet, worker_pool &pool, kept_rows *keep = nullptr)
+	{
+		auto col1it = t1.m_column_hash.find(colname1);
+		if (col1it == t1.m_column_hash.end())
+			throw std::runtime_error("column not found");
+		auto col2it = t2.m_column_hash.find(colname2);
+		if (col2it == t2.m_column_hash.end())
+			throw std::runtime_error("column not found");
+
+		auto &col1 = *t1.m_columns[col1it->second];
+		auto &col2 = *t2.m_columns[col2it->second];
+
+		std::vector<const column_base *> cols;
+		if (!quiet)
+			cols = join_columns(t1, t2, columns, which);
+		if (quiet)
+			keep = nullptr;
+
+		std::optional<result_writer> out;
+		auto print = [&cols, quiet, &which, &out, keep](std::size_t i1, std::size_t i2)
+		{
+			if (quiet)
+				return;
+
+			write_pair(cols, which, i1, i2, *out);
+			if (keep)
+			{
+				keep->add(i1);
+				keep->add(i2);
+			}
+		};
+
+		if (!quiet)
+		{
+			out.emplace();
+			write_header(columns, *out);
+		}
+
+		std::size_t num_matching = 0;
+		auto emit = [&print, &num_matching, &t1, &t2](std::size_t i1, std::size_t i2)
+		{
+			if (t1.is_dead(i1) || t2.is_dead(i2))
+				return;
+			print(i1, i2);
+			++num_matching;
+		};
+		bool count_only = join_counts_only(t1, t2, quiet);
+		auto side1 = t1.join_side_of(col1), side2 = t2.join_side_of(col2);
+
+		bool joined = false;
+		with_join_keys(col1, [&](const auto &keys1)
+					   { with_join_keys(col2, [&](const auto &keys2)
+										{
+											using K1 = typename std::decay_t<decltype(keys1)>::key_type;
+											using K2 = typename std::decay_t<decltype(keys2)>::key_type;
+											if constexpr (std::is_same_v<K1, K2>)
+											{
+												switch (plan_join(side1, side2, count_only))
+												{
+												case join_plan::hash_join:
+												{
+													auto n = hash_join(keys1, keys2, pool, count_only, emit);
+													if (count_only)
+														num_matching = n;
+													// leave t2's index as fresh as probing it would have
+													for (auto *index : {side2.hash, side2.tree})
+														if (index)
+															index->refresh();
+													break;
+												}
+												case join_plan::probe_index1:
+												{
+													counters.index_lookups += col2.size();
+													counters.join_probes += col2.size();
+													if (count_only)
+													{
+														num_matching = side1.index()->count_join(col2);
+														break;
+													}
+													std::vector<join_pairs> found(1);
+													side1.index()->join(col2, [&found](std::size_t i2, std::size_t i1)
+																	  { found[0].emplace_back(i1, i2); });
+													stitch_by_first(found, col1.size(), found[0].size(), emit);
+													break;
+												}
+												case join_plan::probe_index2:
+													counters.index_lookups += col1.size();
+													counters.join_probes += col1.size();
+													if (count_only)
+														num_matching = side2.index()->count_join(col1);
+													else
+														side2.index()->join(col1, emit);
+													break;
+												case join_plan::merge_indexes:
+												{
+													auto n = merge_indexes(*side1.tree, *side2.tree, col1.size(), count_only, emit);
+													if (count_only)
+														num_matching = n;
+													break;
+												}
+												}
+												joined = true;
+											} }); });
+		if (joined)
+			return num_matching;
+
+		// keys of different types
+		auto index = side2.index();
+		if (!index)
+		{
+			counters.rows_scanned += col2.size();
+			index = col2.generate_index(index_type::hash);
+		}
+
+		counters.index_lookups += col1.size();
+		counters.join_probes += col1.size();
+		index->join(col1, emit);
+
+		if (index != side2.index())
+			delete index;
+
+		return num_matching;
+	}
+
+	// JOIN's output for the pairs join kept earlier
+	static void print_pairs(const table &t1, const table &t2, const std::vector<std::string> &columns,
+							const std::vector<std::size_t> &which, const std::vector<std::size_t> &pairs)
+	{
+		auto cols = join_columns(t1, t2, columns, which);
+		result_writer out;
+		write_header(columns, out);
+		for (std::size_t i = 0; i + 1 < pairs.size(); i += 2)
+			write_pair(cols, which, pairs[i], pairs[i + 1], out);
+	}
+
+	// changes whenever the rows, their ids or the indexes do, and is never reused by another table,
+	// so a result computed at one version holds as long as the table stays at it
+	std::uint64_t version() const { return m_version; }
+
+	// EXPLAIN PRINT and DELETE: how the rows matching where are found, and whether quiet PRINT of a
+	// single condition only counts them
+	std::string explain_lookup(const where_clause &where, bool count_only, const worker_pool &pool) const
+	{
+		std::string res;
+		if (where.size() == 1 && where[0].size() == 1)
+		{
+			const auto &term = where[0][0];
+			if (auto index = pick_index(column_named(term.column), term.comp))
+				res = describe(*index) + (count_only ? ", counting from its key counts" : ", reading the matching keys' rows");
+			else
+				res = describe_scan(term.column, pool);
+		}
+		else
+		{
+			for (const auto &group : where)
+			{
+				if (!res.empty())
+					res += "; or ";
+				auto plan = plan_group(group);
+				if (plan.index)
+					res += describe(*plan.index) + " for " + describe(group[plan.driver]) + " (" + std::to_string(plan.estimate) + " rows)";
+				else
+					res += describe_scan(group[plan.driver].column, pool) + " for " + describe(group[plan.driver]);
+
+				std::string rest;
+				for (std::size_t i = 0; i < group.size(); ++i)
+					if (i != plan.driver)
+						rest += (rest.empty() ? "" : " and ") + describe(group[i]);
+				if (!rest.empty())
+					res += ", then " + rest + " checked on those rows";
+			}
+			if (where.size() > 1)
+				res += "; merged in a row bitmap";
+		}
+		if (m_num_dead)
+			res += ", leaving out " + std::to_string(m_num_dead) + " dead rows";
+		return res;
+	}
+
+	// EXPLAIN DELETE: what happens to the rows once found
+	std::string explain_delete(double compact_at) const
+	{
+		if (compact_at <= 0)
+			return "dropped from " + std::to_string(m_columns.size()) + " column(s) and " + std::to_string(m_indexes.size()) + " index(es)";
+		char fraction[max_cell_chars];
+		return "marked dead, the table is compacted once more than " + std::string(fraction, format_cell(fraction, compact_at)) + " of its rows are";
+	}
+
+	// EXPLAIN JOIN: the strategy join picks for these columns, named after the tables
+	static std::string explain_join(const table &t1, const table &t2, const std::string &name1, const std::string &name2,
+									const std::string &colname1, const std::string &colname2, bool quiet)
+	{
+		auto &col1 = *t1.column_named(colname1);
+		auto &col2 = *t2.column_named(colname2);
+		bool count_only = join_counts_only(t1, t2, quiet);
+		auto side1 = t1.join_side_of(col1), side2 = t2.join_side_of(col2);
+
+		std::optional<join_plan> plan;
+		with_join_keys(col1, [&](const auto &keys1)
+					   { with_join_keys(col2, [&](const auto &keys2)
+										{
+											using K1 = typename std::decay_t<decltype(keys1)>::key_type;
+											using K2 = typename std::decay_t<decltype(keys2)>::key_type;
+											if constexpr (std::is_same_v<K1, K2>)
+												plan = plan_join(side1, side2, count_only); }); });
+
+		auto rows = [](const std::string &name, const column_base &col)
+		{ return name + "." + col.name + " (" + std::to_string(col.size()) + " rows)"; };
+		// matches found in t2 or key order go through a sort into t1 order, unless they are only counted
+		std::string resorted = count_only ? ", counting matches" : ", the matches sorted back into " + name1 + " order";
+		std::string counting = count_only ? ", counting matches" : "";
+		if (!plan)
+			return "keys of different types, each row of " + rows(name1, col1) + " probes " +
+				   (side2.index() ? name2 + "'s " + describe(*side2.index()) : "a temporary hash index on " + name2 + "." + col2.name);
+
+		switch (*plan)
+		{
+		case join_plan::hash_join:
+			if (col2.size() <= col1.size())
+				return "hash join building on " + rows(name2, col2) + ", probed with " + rows(name1, col1) + counting;
+			return "hash join building on " + rows(name1, col1) + ", probed with " + rows(name2, col2) + resorted;
+		case join_plan::probe_index1:
+			return "each row of " + rows(name2, col2) + " probes " + name1 + "'s " + describe(*side1.index()) + resorted;
+		case join_plan::probe_index2:
+			return "each row of " + rows(name1, col1) + " probes " + name2 + "'s " + describe(*side2.index()) + counting;
+		case join_plan::merge_indexes:
+			return "merge of " + name1 + "'s " + describe(*side1.tree) + " and " + name2 + "'s " + describe(*side2.tree) + " in key order" +
+				   (count_only ? ", counting from their key counts" : resorted);
+		}
+		return {};
+	}
+
+private:
+	// the printed columns of each table, looked up once; which[i] says whose column i is
+	static std::vector<const column_base *> join_columns(const table &t1, const table &t2, const std::vector<std::string> &columns,
+														  const std::vector<std::size_t> &which)
+	{
+		std::vector<const column_base *> cols(columns.size());
+		for (std::size_t i = 0; i < columns.size(); ++i)
+			cols[i] = (which[i] == 1 ? t1 : t2).column_named(columns[i]);
+		return cols;
+	}
+
+	static void write_pair(const std::vector<const column_base *> &cols, const std::vector<std::size_t> &which,
+						   std::size_t i1, std::size_t i2, result_writer &out)
+	{
+		for (std::size_t i = 0; i < cols.size(); ++i)
+		{
+			cols[i]->write(which[i] == 1 ? i1 : i2, out);
+			out.put(' ');
+		}
+		out.put('\n');
+	}
+
+	// what JOIN plans with for one of its columns
+	join_side join_side_of(const column_base &col) const
+	{
+		return {col.size(), find_index(&col, index_type::hash), find_index(&col, index_type::bst)};
+	}
+
+	// pairs with a dead row have to be seen to be left out, so those joins can't just count
+	static bool join_counts_only(const table &t1, const table &t2, bool quiet)
+	{
+		return quiet && !t1.m_num_dead && !t2.m_num_dead;
+	}
+
+	// "scan of 1000 rows of column key on 4 thread(s)", for EXPLAIN
+	std::string describe_scan(const std::string &column, const worker_pool &pool) const
+	{
+		auto &col = *column_named(column);
+		std::size_t morsels = (col.size() + morsel_rows - 1) / morsel_rows;
+		return "scan of " + std::to_string(col.size()) + " rows of column " + col.name + " on " +
+			   std::to_string(std::max<std::size_t>(1, std::min(pool.size(), morsels))) + " thread(s)";
+	}
+
+	// "key < 5", for EXPLAIN
+	static std::string describe(const where_term &term)
+	{
+		char op = term.comp == compare_t::equals ? '=' : term.comp == compare_t::less ? '<' : '>';
+		return term.column + ' ' + op + ' ' + term.value;
+	}
+
+	// "bst index on key", for EXPLAIN
+	static std::string describe(const index_base &index)
+	{
+		std::string res = (index.type() == index_type::bst ? "bst index on " : "hash index on ") + index.ref->name;
+		if (index.stale())
+			res += " (stale, rebuilt first)";
+		return res;
+	}
+
+	// quiet PRINT of one condition: indexes count equal keys, and trees ranges of them, from their
+	// key counts
+	std::size_t count_matching(const where_term &term, worker_pool &pool) const
+	{
+		auto &col = *column_named(term.column);
+		void *value = col.buff_from_str(term.value);
+
+		std::size_t num_matching;
+		auto pred = col.bind(value, term.comp);
+		if (auto index = pick_index(&col, term.comp))
+		{
+			++counters.index_lookups;
+			num_matching = index->count_matching(value, term.comp);
+		}
+		else
+			num_matching = count_rows(pool, *pred, col.size());
+		// indexes hold dead rows until the next compaction
+		if (m_num_dead)
+			num_matching -= count_dead(*pred);
+		return num_matching;
+	}
+
+	// the live rows matching where. A group of ANDed terms starts from the rows one of them selects
+	// and checks the others on those rows only; several groups are ORed together in a row bitmap.
+	// Rows come out in row order, except that a single term keeps its index's order unless
+	// row_order, so which index drives a compound clause never shows in its output
+	void select_where(const where_clause &where, bool row_order, worker_pool &pool, std::vector<std::size_t> &out) const
+	{
+		if (where.size() == 1)
+			select_group(where[0], row_order || where[0].size() > 1, pool, out);
+		else
+		{
+			static bit_vector selected;
+			static std::vector<std::size_t> rows;
+			selected.clear();
+			selected.resize(stored_rows());
+			for (const auto &group : where)
+			{
+				select_group(group, false, pool, rows);
+				for (auto row : rows)
+					selected.set(row);
+			}
+			out.resize(stored_rows());
+			out.resize(selected.select(true, 0, stored_rows(), out.data()));
+		}
+		drop_dead(out);
 	}
-	else
+
+	// how select_group finds the first rows of a group: through the index promising the fewest, or
+	// else by scanning for the first equality term, or the first term
+	struct group_plan
 	{
-		auto res = new hash_index<T>(this);
-		return res;
+		std::size_t driver = 0;
+		index_base *index = nullptr;
+		std::size_t estimate = 0;
+	};
+
+	group_plan plan_group(const std::vector<where_term> &group) const
+	{
+		group_plan plan;
+		for (std::size_t i = 0; i < group.size(); ++i)
+		{
+			auto &col = *column_named(group[i].column);
+			auto index = pick_index(&col, group[i].comp);
+			if (!index)
+				continue;
+			auto n = estimate_matching(*index, col, group[i]);
+			if (!plan.index || n < plan.estimate)
+				plan = {i, index, n};
+		}
+
+		if (!plan.index)
+			for (std::size_t i = group.size(); i-- > 0;)
+				if (group[i].comp == compare_t::equals)
+					plan.driver = i;
+		return plan;
 	}
-}
 
-class table
-{
-public:
-	table() : m_index{} {}
+	// the rows an index finds for term, from its key counts; a stale index isn't rebuilt for an
+	// estimate, its keys are taken to split the rows evenly
+	static std::size_t estimate_matching(index_base &index, const column_base &col, const where_term &term)
+	{
+		if (!index.stale())
+			return index.count_matching(col.buff_from_str(term.value), term.comp);
+		auto per_key = col.size() / std::max<std::size_t>(1, index.distinct());
+		return term.comp == compare_t::equals ? per_key : col.size() / 2;
+	}
 
-	std::size_t generate_index(index_type type, const std::string &column)
+	// the rows matching every term of group, dead ones included
+	void select_group(const std::vector<where_term> &group, bool row_order, worker_pool &pool, std::vector<std::size_t> &out) const
 	{
-		auto it = m_column_hash.find(column);
+		auto plan = plan_group(group);
+		const auto &first = group[plan.driver];
+		auto &col = *column_named(first.column);
+		void *value = col.buff_from_str(first.value);
+
+		out.clear();
+		if (!plan.index)
+			select_rows(pool, *col.bind(value, first.comp), col.size(), out);
+		else if (row_order)
+		{
+			++counters.index_lookups;
+			// copied, the index may hand out one of its own lists, which a delete changes
+			auto &matching = plan.index->get_matching_rows(value, first.comp);
+			out.assign(matching.begin(), matching.end());
+		}
+		else
+		{
+			++counters.index_lookups;
+			out.reserve(plan.estimate);
+			plan.index->do_on_matching_rows(value, first.comp, [&out](std::size_t row)
+											{ out.push_back(row); });
+		}
+
+		for (std::size_t i = 0; i < group.size() && !out.empty(); ++i)
+			if (i != plan.driver)
+			{
+				auto &other = *column_named(group[i].column);
+				filter_rows(pool, *other.bind(other.buff_from_str(group[i].value), group[i].comp), out);
+			}
+	}
+
+	// takes rows (sorted) out of the index and every column
+	void drop_rows(const std::vector<std::size_t> &rows)
+	{
+		// the indexes look up the keys of the deleted rows, so they go first
+		for (auto *index : m_indexes)
+			index->delete_rows(rows);
+		for (auto *icol : m_columns)
+			icol->delete_rows(rows);
+	}
+
+	const column_base *column_named(const std::string &name) const
+	{
+		auto it = m_column_hash.find(name);
 		if (it == m_column_hash.end())
 			throw std::runtime_error("column not found");
+		return m_columns[it->second];
+	}
 
-		auto col = m_columns[it->second];
+	// the printed columns, looked up once per command instead of once per cell
+	std::vector<const column_base *> resolve(const std::vector<std::string> &columns) const
+	{
+		std::vector<const column_base *> cols;
+		cols.reserve(columns.size());
+		for (const auto &colname : columns)
+			cols.push_back(column_named(colname));
+		return cols;
+	}
+
+	static void write_header(const std::vector<std::string> &columns, result_writer &out)
+	{
+		for (const auto &colname : columns)
+		{
+			out.put(std::string_view(colname));
+			out.put(' ');
+		}
+		out.put('\n');
+	}
+
+	// prints the header and then the given rows in stages: the rows go through in batches, each
+	// column formats its cells of a batch in one gather call, as a task on the pool, and the
+	// batches are then stitched into lines in order
+	static void write_rows(const std::vector<const column_base *> &cols, const std::vector<std::string> &columns,
+						   const std::vector<std::size_t> &rows, worker_pool &pool)
+	{
+		constexpr std::size_t batch_rows = 4096;
 
-		if (m_index)
+		result_writer out;
+		write_header(columns, out);
+		if (cols.empty())
 		{
-			if (col == m_index->ref) // if already exists there
-				return m_index->distinct();
-			
-			delete m_index;
+			for (std::size_t i = 0; i < rows.size(); ++i)
+				out.put('\n');
+			return;
 		}
 
-		m_index = col->generate_index(type);
+		// the batches formatted per round, cells[b * cols.size() + c] holds column c of batch b
+		std::size_t round = 2 * pool.size();
+		static std::vector<cell_text> cells;
+		if (cells.size() < round * cols.size())
+			cells.resize(round * cols.size());
+
+		for (std::size_t first = 0; first < rows.size(); first += round * batch_rows)
+		{
+			std::size_t batches = std::min(round, (rows.size() - first + batch_rows - 1) / batch_rows);
+			pool.run(batches * cols.size(), [&](std::size_t task)
+					 {
+						 std::size_t b = task / cols.size(), c = task % cols.size();
+						 std::size_t row = first + b * batch_rows;
+						 cols[c]->gather(rows.data() + row, std::min(batch_rows, rows.size() - row), cells[task]); });
+
+			for (std::size_t b = 0; b < batches; ++b)
+			{
+				const cell_text *batch = cells.data() + b * cols.size();
+				// room for the longest line this batch can have, plus what block copies overrun by
+				std::size_t line = 1 + cell_text::copy_block;
+				for (std::size_t c = 0; c < cols.size(); ++c)
+					line += batch[c].widest();
+
+				if (line > result_writer::max_reserve())
+				{
+					for (std::size_t i = 0; i < batch[0].size(); ++i)
+					{
+						for (std::size_t c = 0; c < cols.size(); ++c)
+							out.put(batch[c][i]);
+						out.put('\n');
+					}
+					continue;
+				}
 
-		return m_index->distinct();
+				for (std::size_t i = 0; i < batch[0].size(); ++i)
+				{
+					// short cells go as one fixed size copy, the next cell overwrites what was extra
+					char *pos = out.reserve(line);
+					for (std::size_t c = 0; c < cols.size(); ++c)
+					{
+						auto cell = batch[c][i];
+						if (cell.size() <= cell_text::copy_block)
+							std::memcpy(pos, cell.data(), cell_text::copy_block);
+						else
+							std::memcpy(pos, cell.data(), cell.size());
+						pos += cell.size();
+					}
+					*pos++ = '\n';
+					out.advance(pos);
+				}
+			}
+		}
 	}
 
-	// returns number of matching rows found
-	std::size_t print(const std::vector<std::string> &columns, const std::string &selected_column, compare_t comp, const std::string &compare_val, bool quiet) const
+	// the dead rows in order, in a buffer reused across calls
+	const std::vector<std::size_t> &dead_rows() const
 	{
-		auto selected_column_it = m_column_hash.find(selected_column);
-		if (selected_column_it == m_column_hash.end())
-			throw std::runtime_error("column not found");
+		static std::vector<std::size_t> rows;
+		rows.resize(m_dead.size());
+		rows.resize(m_dead.select(true, 0, m_dead.size(), rows.data()));
+		return rows;
+	}
 
-		column_base &col = *m_columns[selected_column_it->second];
-		void *compare_value_buff = col.buff_from_str(compare_val);
+	// removes the dead rows from a sorted row list
+	void drop_dead(std::vector<std::size_t> &rows) const
+	{
+		if (m_num_dead)
+			rows.erase(std::remove_if(rows.begin(), rows.end(), [this](std::size_t row)
+									  { return is_dead(row); }),
+					   rows.end());
+	}
 
-		if (quiet)
+	// matches of pred among the dead rows, one count per run of consecutive dead rows
+	std::size_t count_dead(const predicate &pred) const
+	{
+		auto &dead = dead_rows();
+		std::size_t res = 0;
+		for (std::size_t k = 0; k < dead.size();)
 		{
-			std::size_t num_matching = 0;
-			if (m_index && m_index->ref == &col)
-				m_index->do_on_matching_rows(compare_value_buff, comp, [&num_matching](std::size_t){ ++num_matching; });
-			else
-				for (std::size_t i = 0; i < col.size(); ++i)
-					if (col.compare(i, compare_value_buff) == static_cast<int>(comp))
-						++num_matching;
-			return num_matching;
+			std::size_t first = dead[k];
+			while (++k < dead.size() && dead[k] == dead[k - 1] + 1)
+				;
+			res += pred.count(first, dead[k - 1] + 1);
 		}
-		else
-		{
-			static std::vector<std::size_t> rows;
-			rows.clear();
+		return res;
+	}
 
-			rows.reserve(col.size());
-			if (m_index && m_index->ref == &col)
-				m_index->do_on_matching_rows(compare_value_buff, comp, [](std::size_t row){ rows.push_back(row); });
-			else
-				for (std::size_t i = 0; i < col.size(); ++i)
-					if (col.compare(i, compare_value_buff) == static_cast<int>(comp))
-						rows.push_back(i);
+	std::vector<column_base *> m_columns;
+	std::unordered_map<std::string, std::size_t> m_column_hash;
+	// at most one index of each type per column
+	std::vector<index_base *> m_indexes;
+	// rows DELETE marked but hasn't dropped yet, only as long as the last row it marked
+	bit_vector m_dead;
+	std::size_t m_num_dead = 0;
+	std::uint64_t m_version = next_version();
+
+	// versions are handed out from one counter, so a table created under a removed one's name
+	// doesn't pick up its cached results
+	static std::uint64_t next_version()
+	{
+		static std::uint64_t last = 0;
+		return ++last;
+	}
+};
+
+// write-ahead log (--wal): every command that changes a table appends a record, and startup replays
+// them. A record is its length, a checksum, a type byte and varint-encoded fields; INSERT writes one
+// record per parsed batch of rows holding all its cells. Records collect in a buffer and go out with
+// a single fdatasync per group, when the command loop is about to wait for input, before any output
+// reaches stdout, when a lot is pending or at exit. CHECKPOINT saves every table as a snapshot next to the log and starts a new
+// log that just loads them
+class write_ahead_log
+{
+public:
+	write_ahead_log(std::string wal_path) : path{std::move(wal_path)} {}
 
-			for (const auto &colname : columns)
-				std::cout << colname << ' ';
-			std::cout << '\n';
+	write_ahead_log(const write_ahead_log &) = delete;
+	write_ahead_log &operator=(const write_ahead_log &) = delete;
 
-			for (auto row : rows)
+	~write_ahead_log()
+	{
+		if (fd < 0)
+			return;
+		try
+		{
+			commit();
+		}
+		catch (const std::runtime_error &)
+		{
+		}
+		::close(fd);
+	}
+
+	// replays the log into tables, drops a torn tail and opens it for appending; returns the
+	// number of commands replayed
+	std::size_t recover(std::unordered_map<std::string, table> &tables, worker_pool &pool, double compact_at)
+	{
+		std::size_t replayed = 0, end = 0;
+		{
+			mapped_file log(path);
+			if (log.size() >= header_size)
 			{
-				for (const auto &colname : columns)
+				if (std::memcmp(log.data(), wal_magic, sizeof(wal_magic)) != 0)
+					throw std::runtime_error(path + " is not a write-ahead log");
+				std::memcpy(&generation, log.data() + sizeof(wal_magic), sizeof(generation));
+
+				// the records up to the end of the last whole command, an INSERT only counts
+				// once its last batch made it
+				end = header_size;
+				for (std::size_t pos = header_size; pos < log.size();)
+				{
+					auto record = next_record(log.data(), log.size(), pos);
+					if (!record.first)
+						break;
+					pos = static_cast<std::size_t>(record.second - log.data());
+					if (completes_command(record.first, record.second))
+						end = pos;
+				}
+
+				for (std::size_t pos = header_size; pos < end;)
 				{
-					auto it = m_column_hash.find(colname);
-					if (it == m_column_hash.end())
-						throw std::runtime_error("column not found");
-					m_columns[it->second]->print(row);
-					std::cout << ' ';
+					auto record = next_record(log.data(), end, pos);
+					replayed += apply(record.first, record.second, tables, pool, compact_at);
+					pos = static_cast<std::size_t>(record.second - log.data());
 				}
-				std::cout << '\n';
 			}
+		}
 
-			return rows.size();
+		if (end == 0)
+		{
+			start_log(path, {});
+			end = header_size;
 		}
+		else if (::truncate(path.c_str(), static_cast<off_t>(end)) != 0)
+			throw std::runtime_error("cannot truncate " + path);
+
+		fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+		if (fd < 0)
+			throw std::runtime_error("cannot open " + path);
+		return replayed;
 	}
 
-	// prints all rows
-	void print(const std::vector<std::string> &columns) const
+	void log_create(std::string_view name, const std::vector<std::string> &types, const std::vector<std::string> &columns)
 	{
-		for (const auto &colname : columns)
-			std::cout << colname << ' ';
-		std::cout << '\n';
+		auto at = begin_record(record_type::create);
+		put_string(name);
+		put_varint(types.size());
+		for (std::size_t i = 0; i < types.size(); ++i)
+		{
+			put_string(types[i]);
+			put_string(columns[i]);
+		}
+		end_record(at);
+	}
 
-		std::size_t N = num_rows();
-		for (std::size_t i = 0; i < N; ++i)
+	// rows [offset, offset + rows) of an INSERT of N rows, cells row-major with cols per row
+	void log_insert(std::string_view name, std::size_t N, std::size_t offset, std::size_t rows, std::size_t cols, const std::string_view *cells)
+	{
+		auto at = begin_record(record_type::insert);
+		put_string(name);
+		put_varint(N);
+		put_varint(offset);
+		put_varint(rows);
+		put_varint(cols);
+		for (std::size_t i = 0; i < rows * cols; ++i)
+			put_string(cells[i]);
+		end_record(at);
+	}
+
+	// the groups of where, each with its terms
+	void log_delete(std::string_view name, const where_clause &where)
+	{
+		auto at = begin_record(record_type::delete_where);
+		put_string(name);
+		put_varint(where.size());
+		for (const auto &group : where)
 		{
-			for (const auto &colname : columns)
+			put_varint(group.size());
+			for (const auto &term : group)
 			{
-				auto it = m_column_hash.find(colname);
-				if (it == m_column_hash.end())
-					throw std::runtime_error("column not found");
-				m_columns[it->second]->print(i);
-				std::cout << ' ';
+				put_string(term.column);
+				put_varint(static_cast<std::size_t>(static_cast<int>(term.comp) + 1));
+				put_string(term.value);
 			}
-			std::cout << '\n';
 		}
+		end_record(at);
 	}
 
-	std::size_t delete_rows(const std::string &selected_column, compare_t comp, const std::string &compare_val)
+	void log_remove(std::string_view name)
 	{
-		auto selected_column_it = m_column_hash.find(selected_column);
-		if (selected_column_it == m_column_hash.end())
-			throw std::runtime_error("column not found");
+		auto at = begin_record(record_type::remove);
+		put_string(name);
+		end_record(at);
+	}
 
-		column_base &col = *m_columns[selected_column_it->second];
-		void *compare_value_buff = col.buff_from_str(compare_val);
+	void log_generate(std::string_view name, index_type type, std::string_view column)
+	{
+		auto at = begin_record(record_type::generate);
+		put_string(name);
+		put_varint(type == index_type::hash);
+		put_string(column);
+		end_record(at);
+	}
 
-		const std::vector<std::size_t> *rows;
-		if (m_index && m_index->ref == &col) // if on indexed column, take special care
+	// copies a snapshot for LOAD to a file next to the log and syncs it, so replay reads the same
+	// bytes however the original changes later; the copy goes with the next checkpoint
+	std::string adopt_snapshot(const std::string &file)
+	{
+		auto copy = path + '.' + std::to_string(generation) + ".load." + std::to_string(num_loads);
+		int from = ::open(file.c_str(), O_RDONLY);
+		if (from < 0)
+			throw std::runtime_error("cannot open " + file);
+		int to = ::open(copy.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (to < 0)
 		{
-			rows = &m_index->get_matching_rows(compare_value_buff, comp);
+			::close(from);
+			throw std::runtime_error("cannot open " + copy + " for writing");
 		}
-		else
+
+		try
+		{
+			std::vector<char> chunk(1 << 20);
+			for (;;)
+			{
+				auto n = ::read(from, chunk.data(), chunk.size());
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n < 0)
+					throw std::runtime_error("cannot read " + file + ": " + std::strerror(errno));
+				if (n == 0)
+					break;
+				write_fd(to, chunk.data(), static_cast<std::size_t>(n));
+			}
+			if (::fsync(to) != 0)
+				throw std::runtime_error("cannot sync " + copy);
+		}
+		catch (const std::runtime_error &)
 		{
-			static std::vector<std::size_t> buffer;
-			buffer.clear();
-			buffer.reserve(col.size());
-			for (std::size_t i = 0; i < col.size(); ++i)
-				if (col.compare(i, compare_value_buff) == static_cast<int>(comp))
-					buffer.push_back(i);
+			::close(from);
+			::close(to);
+			std::remove(copy.c_str());
+			throw;
+		}
+		::close(from);
+		::close(to);
+		sync_path(directory());
+		++num_loads;
+		return copy;
+	}
+
+	// file is a copy adopt_snapshot made
+	void log_load(const std::string &file)
+	{
+		auto at = begin_record(record_type::load);
+		put_string(file);
+		end_record(at);
+		snapshots.push_back(file);
+	}
+
+	// writes what was logged since the last commit and syncs it, once for the whole group
+	void commit()
+	{
+		if (unsynced == 0 && buffer.empty())
+			return;
+		write_buffer();
+		if (::fdatasync(fd) != 0)
+			throw std::runtime_error("cannot sync " + path);
+		unsynced = 0;
+	}
+
+	// saves every table as a snapshot next to the log, then swaps in a log that loads them and
+	// deletes the previous checkpoint's snapshots; returns the snapshots written
+	std::size_t checkpoint(std::unordered_map<std::string, table> &tables)
+	{
+		commit();
 
-			rows = &buffer;
+		std::vector<std::string> files;
+		++generation;
+		num_loads = 0;
+		for (auto &[name, t] : tables)
+		{
+			files.push_back(path + '.' + std::to_string(generation) + '.' + std::to_string(files.size()));
+			t.save(name, files.back());
+			sync_path(files.back());
 		}
 
-		for (auto *icol : m_columns)
+		start_log(path + ".new", files);
+		if (std::rename((path + ".new").c_str(), path.c_str()) != 0)
+			throw std::runtime_error("cannot replace " + path);
+		sync_path(directory());
+
+		::close(fd);
+		fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+		if (fd < 0)
+			throw std::runtime_error("cannot open " + path);
+
+		for (const auto &file : snapshots)
+			std::remove(file.c_str());
+		snapshots.swap(files);
+		return snapshots.size();
+	}
+
+private:
+	enum class record_type : std::uint8_t
+	{
+		create,
+		insert,
+		delete_rows,
+		remove,
+		generate,
+		load,
+		checkpoint_load,
+		// DELETE with a where_clause, delete_rows is the single condition logs before it
+		delete_where,
+	};
+
+	static constexpr char wal_magic[8] = {'s', 'i', 'l', 'l', 'y', 'W', 'A', 'L'};
+	static constexpr std::size_t header_size = sizeof(wal_magic) + sizeof(std::uint64_t);
+	// length and checksum in front of each record
+	static constexpr std::size_t frame_size = sizeof(std::uint32_t) + sizeof(std::uint64_t);
+	// write out (without syncing) once this much is buffered, sync once this much is unsynced
+	static constexpr std::size_t write_bytes = 1 << 20, sync_bytes = 64 << 20;
+
+	// a whole file mapped read-only, empty if it doesn't exist
+	class mapped_file
+	{
+	public:
+		mapped_file(const std::string &file)
+		{
+			int map_fd = ::open(file.c_str(), O_RDONLY);
+			if (map_fd < 0)
+			{
+				if (errno != ENOENT)
+					throw std::runtime_error("cannot open " + file);
+				return;
+			}
+			struct stat st;
+			if (fstat(map_fd, &st) == 0 && st.st_size > 0)
+			{
+				len = static_cast<std::size_t>(st.st_size);
+				void *map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, map_fd, 0);
+				if (map == MAP_FAILED)
+				{
+					::close(map_fd);
+					throw std::runtime_error("cannot map " + file);
+				}
+				madvise(map, len, MADV_SEQUENTIAL);
+				ptr = static_cast<const char *>(map);
+			}
+			::close(map_fd);
+		}
+		mapped_file(const mapped_file &) = delete;
+		mapped_file &operator=(const mapped_file &) = delete;
+		~mapped_file()
+		{
+			if (ptr)
+				munmap(const_cast<char *>(ptr), len);
+		}
+
+		const char *data() const { return ptr; }
+		std::size_t size() const { return ptr ? len : 0; }
+
+	private:
+		const char *ptr = nullptr;
+		std::size_t len = 0;
+	};
+
+	// reads the fields of one record, throws if it runs out
+	struct record_reader
+	{
+		const char *pos, *end;
+
+		std::size_t varint()
+		{
+			std::size_t value = 0;
+			for (int shift = 0;; shift += 7)
+			{
+				if (pos == end || shift > 63)
+					throw std::runtime_error("write-ahead log is corrupt");
+				auto byte = static_cast<unsigned char>(*pos++);
+				value |= static_cast<std::size_t>(byte & 0x7f) << shift;
+				if (!(byte & 0x80))
+					return value;
+			}
+		}
+
+		std::string_view string()
+		{
+			auto n = varint();
+			if (n > static_cast<std::size_t>(end - pos))
+				throw std::runtime_error("write-ahead log is corrupt");
+			pos += n;
+			return {pos - n, n};
+		}
+	};
+
+	std::string path;
+	int fd = -1;
+	std::uint64_t generation = 0;
+	// the snapshots the log loads, its checkpoint's and LOAD's copies, deleted by the next checkpoint
+	std::vector<std::string> snapshots;
+	// LOAD copies made in this generation
+	std::size_t num_loads = 0;
+	std::vector<char> buffer;
+	std::size_t unsynced = 0;
+
+	// 8 bytes at a time through the hash finalizer, enough to tell a torn or garbled record
+	static std::uint64_t checksum(const char *data, std::size_t n)
+	{
+		std::uint64_t h = n;
+		std::size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			std::uint64_t word;
+			std::memcpy(&word, data + i, 8);
+			h = mix_hash(h ^ word);
+		}
+		std::uint64_t tail = 0;
+		std::memcpy(&tail, data + i, n - i);
+		return mix_hash(h ^ tail);
+	}
+
+	std::size_t begin_record(record_type type)
+	{
+		auto at = buffer.size();
+		buffer.resize(at + frame_size);
+		buffer.push_back(static_cast<char>(type));
+		return at;
+	}
+
+	void end_record(std::size_t at)
+	{
+		auto body = buffer.data() + at + frame_size;
+		std::size_t n = buffer.size() - at - frame_size;
+		if (n > std::numeric_limits<std::uint32_t>::max())
+			throw std::length_error("write-ahead log record too long");
+		auto len = static_cast<std::uint32_t>(n);
+		auto sum = checksum(body, n);
+		std::memcpy(buffer.data() + at, &len, sizeof(len));
+		std::memcpy(buffer.data() + at + sizeof(len), &sum, sizeof(sum));
+
+		if (buffer.size() >= write_bytes)
+			write_buffer();
+		if (unsynced >= sync_bytes)
+			commit();
+	}
+
+	void put_varint(std::size_t value)
+	{
+		for (; value >= 0x80; value >>= 7)
+			buffer.push_back(static_cast<char>(value | 0x80));
+		buffer.push_back(static_cast<char>(value));
+	}
+
+	void put_string(std::string_view str)
+	{
+		put_varint(str.size());
+		buffer.insert(buffer.end(), str.begin(), str.end());
+	}
+
+	void write_buffer()
+	{
+		write_fd(fd, buffer.data(), buffer.size());
+		unsynced += buffer.size();
+		buffer.clear();
+	}
+
+	void write_fd(int to, const char *data, std::size_t n)
+	{
+		while (n > 0)
+		{
+			auto written = ::write(to, data, n);
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written <= 0)
+				throw std::runtime_error("cannot write " + path + ": " + std::strerror(errno));
+			data += written;
+			n -= static_cast<std::size_t>(written);
+		}
+	}
+
+	std::string directory() const
+	{
+		auto slash = path.find_last_of('/');
+		return slash == std::string::npos ? "." : path.substr(0, slash + 1);
+	}
+
+	static void sync_path(const std::string &file)
+	{
+		int sync_fd = ::open(file.c_str(), O_RDONLY);
+		if (sync_fd < 0 || ::fsync(sync_fd) != 0)
+		{
+			if (sync_fd >= 0)
+				::close(sync_fd);
+			throw std::runtime_error("cannot sync " + file);
+		}
+		::close(sync_fd);
+	}
+
+	// writes a log holding just the header and checkpoint loads of files, synced
+	void start_log(const std::string &file, const std::vector<std::string> &files)
+	{
+		buffer.clear();
+		buffer.insert(buffer.end(), wal_magic, wal_magic + sizeof(wal_magic));
+		buffer.resize(header_size);
+		std::memcpy(buffer.data() + sizeof(wal_magic), &generation, sizeof(generation));
+		for (const auto &snapshot : files)
 		{
-			if (m_index && m_index->ref == icol)
-				m_index->update(true);
-			icol->delete_rows(*rows);
+			auto at = begin_record(record_type::checkpoint_load);
+			put_string(snapshot);
+			end_record(at);
 		}
 
-		return rows->size();
+		int new_fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (new_fd < 0)
+			throw std::runtime_error("cannot open " + file + " for writing");
+		write_fd(new_fd, buffer.data(), buffer.size());
+		buffer.clear();
+		bool synced = ::fsync(new_fd) == 0;
+		::close(new_fd);
+		if (!synced)
+			throw std::runtime_error("cannot sync " + file);
+	}
+
+	// the body of the record at pos and its end, {nullptr, _} if there is no whole record there
+	static std::pair<const char *, const char *> next_record(const char *data, std::size_t size, std::size_t pos)
+	{
+		if (size - pos < frame_size)
+			return {nullptr, nullptr};
+		std::uint32_t len;
+		std::uint64_t sum;
+		std::memcpy(&len, data + pos, sizeof(len));
+		std::memcpy(&sum, data + pos + sizeof(len), sizeof(sum));
+		if (len == 0 || size - pos - frame_size < len || checksum(data + pos + frame_size, len) != sum)
+			return {nullptr, nullptr};
+		return {data + pos + frame_size, data + pos + frame_size + len};
+	}
+
+	// false for the batches of an INSERT before its last one
+	static bool completes_command(const char *body, const char *end)
+	{
+		if (static_cast<record_type>(*body) != record_type::insert)
+			return true;
+		record_reader in{body + 1, end};
+		in.string();
+		auto N = in.varint(), offset = in.varint(), rows = in.varint();
+		return offset + rows == N;
+	}
+
+	// replays one record, returns 1 if it finished a command
+	std::size_t apply(const char *body, const char *end, std::unordered_map<std::string, table> &tables, worker_pool &pool, double compact_at)
+	{
+		record_reader in{body + 1, end};
+		auto find = [&tables](std::string_view name) -> table &
+		{
+			auto it = tables.find(std::string(name));
+			if (it == tables.end())
+				throw std::runtime_error("write-ahead log names a missing table " + std::string(name));
+			return it->second;
+		};
+
+		switch (static_cast<record_type>(*body))
+		{
+		case record_type::create:
+		{
+			std::string name(in.string());
+			if (tables.find(name) != tables.end())
+				throw std::runtime_error("write-ahead log creates existing table " + name);
+			table &t = tables[name];
+			auto N = in.varint();
+			t.reserve_columns(N);
+			for (std::size_t i = 0; i < N; ++i)
+			{
+				auto type = in.string();
+				t.add_typed_column(type, std::string(in.string()));
+			}
+			return 1;
+		}
+		case record_type::insert:
+		{
+			table &t = find(in.string());
+			auto N = in.varint(), offset = in.varint(), rows = in.varint(), cols = in.varint();
+			if (cols != t.num_cols())
+				throw std::runtime_error("write-ahead log is corrupt");
+
+			static std::vector<std::string_view> cells;
+			cells.resize(rows * cols);
+			for (auto &cell : cells)
+				cell = in.string();
+
+			if (offset == 0)
+				t.reserve_rows(t.stored_rows() + N);
+			t.append_rows(cells.data(), rows);
+			if (offset + rows < N)
+				return 0;
+			t.finish_insert(t.stored_rows() - N);
+			return 1;
+		}
+		case record_type::delete_rows:
+		case record_type::delete_where:
+		{
+			table &t = find(in.string());
+			bool single = static_cast<record_type>(*body) == record_type::delete_rows;
+			where_clause where(single ? 1 : in.varint());
+			for (auto &group : where)
+			{
+				group.resize(single ? 1 : in.varint());
+				for (auto &term : group)
+				{
+					term.column = in.string();
+					auto comp = in.varint();
+					if (comp > 2 || !t.contains_column(term.column))
+						throw std::runtime_error("write-ahead log is corrupt");
+					term.comp = static_cast<compare_t>(static_cast<int>(comp) - 1);
+					term.value = in.string();
+				}
+				if (group.empty())
+					throw std::runtime_error("write-ahead log is corrupt");
+			}
+			if (where.empty())
+				throw std::runtime_error("write-ahead log is corrupt");
+			t.delete_rows(where, pool, compact_at);
+			return 1;
+		}
+		case record_type::remove:
+			tables.erase(std::string(in.string()));
+			return 1;
+		case record_type::generate:
+		{
+			table &t = find(in.string());
+			auto type = in.varint() ? index_type::hash : index_type::bst;
+			t.generate_index(type, std::string(in.string()));
+			return 1;
+		}
+		case record_type::load:
+		case record_type::checkpoint_load:
+		{
+			std::string file(in.string());
+			if (static_cast<record_type>(*body) == record_type::checkpoint_load)
+				snapshots.push_back(file);
+			// a load record naming a file that isn't one of our copies is never deleted
+			else if (file.compare(0, path.size() + 1, path + '.') == 0)
+			{
+				snapshots.push_back(file);
+				++num_loads;
+			}
+			snapshot_reader snap(file);
+			std::string name(snap.get_string());
+			if (tables.find(name) != tables.end())
+				throw std::runtime_error("write-ahead log loads existing table " + name);
+			try
+			{
+				tables[name].load(snap);
+			}
+			catch (const std::runtime_error &)
+			{
+				tables.erase(name);
+				throw;
+			}
+			return 1;
+		}
+		}
+		throw std::runtime_error("write-ahead log is corrupt");
 	}
+};
 
-	bool contains_column(const std::string &column) const
+// installed as std::cout's buffer in front of whatever it wrote to, it commits the write-ahead log
+// before any of its text goes on, so no command's output shows before the command is durable,
+// however the input arrives and whoever flushes. If the log cannot be synced the text is dropped
+// and the stream goes bad
+class logged_output : public std::streambuf
+{
+public:
+	logged_output(std::ostream &os, write_ahead_log &wal) : os{os}, wal{wal}
 	{
-		return m_column_hash.find(column) != m_column_hash.end();
+		setp(buffer, buffer + sizeof(buffer));
+		next = os.rdbuf(this);
 	}
 
-	void reserve_columns(std::size_t N) { m_columns.reserve(N); }
+	logged_output(const logged_output &) = delete;
+	logged_output &operator=(const logged_output &) = delete;
 
-	template <typename T>
-	void add_column(const std::string &colname)
+	~logged_output()
 	{
-		m_columns.push_back(new column<T>(colname));
-		m_column_hash[colname] = m_columns.size() - 1;
+		pass_on();
+		os.rdbuf(next);
 	}
 
-	const std::vector<column_base *> &get_columns() const
+protected:
+	int_type overflow(int_type c) override
 	{
-		return m_columns;
+		if (!pass_on())
+			return traits_type::eof();
+		if (!traits_type::eq_int_type(c, traits_type::eof()))
+			sputc(traits_type::to_char_type(c));
+		return traits_type::not_eof(c);
 	}
 
-	std::size_t num_cols() const { return m_columns.size(); }
-	std::size_t num_rows() const
+	// large writes go on in one piece instead of through the buffer
+	std::streamsize xsputn(const char *s, std::streamsize n) override
 	{
-		if (m_columns.empty())
+		if (n <= epptr() - pptr())
+		{
+			std::memcpy(pptr(), s, static_cast<std::size_t>(n));
+			pbump(static_cast<int>(n));
+			return n;
+		}
+		if (!pass_on())
 			return 0;
-		else
-			return m_columns[0]->size();
+		if (n < static_cast<std::streamsize>(sizeof(buffer)))
+			return xsputn(s, n);
+		return next->sputn(s, n);
 	}
 
-	// append value to column
-	// this has faith that you add a new value to all other columns as well
-	void add_value(std::size_t col, const std::string &value)
+	int sync() override
 	{
-		auto which = m_columns[col];
+		if (!pass_on())
+			return -1;
+		return next->pubsync();
+	}
 
-		if (m_index && which == m_index->ref)
-			m_index->push_back(which->buff_from_str(value));
-		else
-			which->push_back(which->buff_from_str(value));
+private:
+	// commits, then hands the buffered text on
+	bool pass_on()
+	{
+		if (failed)
+			return false;
+		try
+		{
+			wal.commit();
+		}
+		catch (const std::runtime_error &e)
+		{
+			std::cerr << "Error during commit: " << e.what() << '\n';
+			failed = true;
+			return false;
+		}
+		auto n = pptr() - pbase();
+		setp(buffer, buffer + sizeof(buffer));
+		return next->sputn(buffer, n) == n;
 	}
 
-	~table()
+	std::ostream &os;
+	write_ahead_log &wal;
+	std::streambuf *next;
+	char buffer[1 << 16];
+	bool failed = false;
+};
+
+// --stats: the wall time and exec_counters of each command, summed up by its first word
+class command_stats
+{
+public:
+	// cmd is the command's first word, anything that isn't a command is summed up as other
+	void start(std::string_view cmd)
 	{
-		delete m_index;
-		for (auto column : m_columns)
-			delete column;
+		if (std::find(std::begin(commands), std::end(commands), cmd) == std::end(commands))
+			cmd = "other";
+		auto it = std::find_if(totals.begin(), totals.end(), [cmd](const entry &e)
+							   { return e.name == cmd; });
+		if (it == totals.end())
+		{
+			it = totals.emplace(totals.end());
+			it->name = cmd;
+		}
+		current = static_cast<std::size_t>(it - totals.begin());
+		before = counters;
+		started = std::chrono::steady_clock::now();
 	}
 
-	static std::size_t join(const table &t1, const table &t2,
-							const std::string &colname1, const std::string &colname2,
-							const std::vector<std::string> &columns, const std::vector<std::size_t> &which,
-							bool quiet)
+	// ends the command start() began, if any
+	void finish()
 	{
-		auto col1it = t1.m_column_hash.find(colname1);
-		if (col1it == t1.m_column_hash.end())
-			throw std::runtime_error("column not found");
-		auto col2it = t2.m_column_hash.find(colname2);
-		if (col2it == t2.m_column_hash.end())
-			throw std::runtime_error("column not found");
+		if (current == none)
+			return;
 
-		auto &col1 = *t1.m_columns[col1it->second];
-		auto &col2 = *t2.m_columns[col2it->second];
+		auto took = std::chrono::steady_clock::now() - started;
+		auto &e = totals[current];
+		++e.commands;
+		e.time += took;
+		e.slowest = std::max(e.slowest, std::chrono::duration_cast<std::chrono::nanoseconds>(took));
+		e.work.rows_scanned += counters.rows_scanned - before.rows_scanned;
+		e.work.index_lookups += counters.index_lookups - before.index_lookups;
+		e.work.index_rebuilds += counters.index_rebuilds - before.index_rebuilds;
+		e.work.index_folds += counters.index_folds - before.index_folds;
+		e.work.join_probes += counters.join_probes - before.join_probes;
+		e.work.bytes_out += counters.bytes_out - before.bytes_out;
+		e.work.cache_hits += counters.cache_hits - before.cache_hits;
+		e.work.cache_misses += counters.cache_misses - before.cache_misses;
+		current = none;
+	}
 
-		auto print = [&columns, &t1, &t2, quiet, &which](std::size_t i1, std::size_t i2)
-		{
-			if (quiet)
-				return;
+	// a table of the totals per command, in order of first use
+	void report(std::ostream &os)
+	{
+		finish();
+		os << std::left << std::setw(12) << "command" << std::right << std::setw(10) << "count" << std::setw(12) << "total ms"
+		   << std::setw(12) << "max ms" << std::setw(14) << "rows scanned" << std::setw(10) << "lookups" << std::setw(10) << "rebuilds"
+		   << std::setw(8) << "folds" << std::setw(14) << "join probes" << std::setw(14) << "bytes out"
+		   << std::setw(12) << "cache hits" << std::setw(14) << "cache misses" << '\n';
+		os << std::fixed << std::setprecision(3);
+		for (const auto &e : totals)
+			os << std::left << std::setw(12) << e.name << std::right << std::setw(10) << e.commands
+			   << std::setw(12) << std::chrono::duration<double, std::milli>(e.time).count()
+			   << std::setw(12) << std::chrono::duration<double, std::milli>(e.slowest).count()
+			   << std::setw(14) << e.work.rows_scanned << std::setw(10) << e.work.index_lookups << std::setw(10) << e.work.index_rebuilds
+			   << std::setw(8) << e.work.index_folds << std::setw(14) << e.work.join_probes << std::setw(14) << e.work.bytes_out
+			   << std::setw(12) << e.work.cache_hits << std::setw(14) << e.work.cache_misses << '\n';
+	}
 
-			for (std::size_t i = 0; i < columns.size(); ++i)
-			{
-				if (which[i] == 1)
-				{
-					auto it = t1.m_column_hash.find(columns[i]);
-					if (it == t1.m_column_hash.end())
-						throw std::runtime_error("column not found");
-					t1.m_columns[it->second]->print(i1);
-				}
-				else
-				{
-					auto it = t2.m_column_hash.find(columns[i]);
-					if (it == t2.m_column_hash.end())
-						throw std::runtime_error("column not found");
-					t2.m_columns[it->second]->print(i2);
-				}
+private:
+	static constexpr std::size_t none = std::numeric_limits<std::size_t>::max();
+	static constexpr std::string_view commands[] = {"CREATE", "INSERT", "PRINT", "DELETE", "JOIN", "GENERATE", "REMOVE",
+													  "SAVE", "LOAD", "CHECKPOINT", "SHOW", "EXPLAIN"};
 
-				std::cout << ' ';
-			}
+	struct entry
+	{
+		std::string name;
+		std::size_t commands = 0;
+		std::chrono::steady_clock::duration time{0};
+		std::chrono::nanoseconds slowest{0};
+		exec_counters work;
+	};
 
-			std::cout << '\n';
-		};
+	// a handful of command names, so a linear search is all it takes
+	std::vector<entry> totals;
+	std::size_t current = none;
+	exec_counters before;
+	std::chrono::steady_clock::time_point started;
+};
 
-		if (!quiet)
+// results of PRINT ... WHERE and JOIN keyed on their normalized command text, with the versions of
+// the tables they read; an entry is only good while both tables are still at those versions, so
+// INSERT, DELETE and REMOVE invalidate without touching the cache. Least recently used entries go
+// first once the entries' row ids and keys outgrow the budget
+class result_cache
+{
+public:
+	struct entry
+	{
+		std::uint64_t v1 = 0, v2 = 0;
+		std::size_t count = 0;
+		// the printed row ids (see kept_rows), empty in quiet mode, which only prints the count
+		std::vector<std::size_t> rows;
+		std::list<std::string>::iterator used;
+	};
+
+	explicit result_cache(std::size_t budget) : budget{budget} {}
+
+	// the most row ids an entry may keep
+	std::size_t max_ids() const { return budget / sizeof(std::size_t); }
+
+	// the entry for key if it's still at versions v1 and v2, nullptr (and a stale entry dropped) if not
+	const entry *find(const std::string &key, std::uint64_t v1, std::uint64_t v2)
+	{
+		auto it = entries.find(key);
+		if (it != entries.end() && (it->second.v1 != v1 || it->second.v2 != v2))
+		{
+			drop(it);
+			it = entries.end();
+		}
+		if (it == entries.end())
 		{
-			for (const auto &colname : columns)
-				std::cout << colname << ' ';
-			std::cout << '\n';
+			++counters.cache_misses;
+			return nullptr;
 		}
 
-		std::size_t num_matching = 0;
-		index_base *index;
-		if (t2.m_index && &col2 == t2.m_index->ref)
-			index = t2.m_index;
-		else
-			index = col2.generate_index(index_type::hash);
+		++counters.cache_hits;
+		lru.splice(lru.begin(), lru, it->second.used);
+		return &it->second;
+	}
 
-		for (std::size_t i1 = 0; i1 < col1.size(); ++i1)
-			index->do_on_matching_rows(col1.buff_from_row(i1), compare_t::equals,
-									   [i1, &print, &num_matching](std::size_t i2)
-									   {
-										   print(i1, i2);
-										   ++num_matching;
-									   });
+	void insert(const std::string &key, std::uint64_t v1, std::uint64_t v2, std::size_t count, std::vector<std::size_t> rows)
+	{
+		if (cost(key, rows) > budget)
+			return;
 
-		if (index != t2.m_index)
-			delete index;
+		auto it = entries.find(key);
+		if (it != entries.end())
+			drop(it);
+		lru.push_front(key);
+		auto &e = entries[key];
+		e = {v1, v2, count, std::move(rows), lru.begin()};
+		used += cost(key, e.rows);
 
-		return num_matching;
+		while (used > budget)
+			drop(entries.find(lru.back()));
 	}
 
 private:
-	std::vector<column_base *> m_columns;
-	std::unordered_map<std::string, std::size_t> m_column_hash;
-	index_base *m_index;
+	static std::size_t cost(const std::string &key, const std::vector<std::size_t> &rows)
+	{
+		// the key is held twice, by the map and the lru list
+		return rows.size() * sizeof(std::size_t) + 2 * key.size() + sizeof(entry) + 64;
+	}
+
+	void drop(std::unordered_map<std::string, entry>::iterator it)
+	{
+		used -= cost(it->first, it->second.rows);
+		lru.erase(it->second.used);
+		entries.erase(it);
+	}
+
+	std::size_t budget;
+	std::size_t used = 0;
+	std::unordered_map<std::string, entry> entries;
+	// keys, most recently used first
+	std::list<std::string> lru;
 };
 
 int main(int argc, char *argv[])
 {
 	std::ios_base::sync_with_stdio(false);
-	std::cin >> std::boolalpha;
 	std::cout << std::boolalpha;
 
 	// Create tableOptions object to parse command line arguments
 	tableOptions options(argc, argv);
+	worker_pool pool(options.numThreads());
+
+	// declared first so it outlives everything else that may print
+	std::optional<piped_output> piped;
+	if (options.isPipelined())
+		piped.emplace(std::cout, STDOUT_FILENO);
 
 	std::unordered_map<std::string, table> tables;
 
-	enum class typenames
+	std::optional<command_stats> stats;
+	if (options.keepStats())
+		stats.emplace();
+
+	std::optional<result_cache> cache;
+	if (options.cacheBytes())
+		cache.emplace(options.cacheBytes());
+	std::string cache_key;
+	kept_rows keep;
+
+	std::optional<write_ahead_log> wal;
+	if (!options.walPath().empty())
 	{
-		intname,
-		stringname,
-		doublename,
-		boolname,
-	};
+		wal.emplace(options.walPath());
+		try
+		{
+			auto N = wal->recover(tables, pool, options.compactAt());
+			if (N)
+				std::cerr << "Recovered " << N << " command(s) from " << options.walPath() << '\n';
+		}
+		catch (const std::runtime_error &e)
+		{
+			std::cerr << "Error during recovery: " << e.what() << '\n';
+			return 1;
+		}
+	}
+
+	// a group of logged commands is made durable before their output shows, and before waiting
+	// for more
+	std::optional<logged_output> logged;
+	if (wal)
+		logged.emplace(std::cout, *wal);
+	command_reader in(STDIN_FILENO, [&wal]()
+					  {
+						  if (wal)
+							  wal->commit();
+						  std::cout.flush(); },
+					  options.isPipelined());
 
-	std::string cmd;
 	std::string tablename1, tablename2;
 	std::string tmp, tmp2, tmp3;
-	std::vector<std::string> strings;
+	std::vector<std::string> strings, types;
 	std::vector<std::size_t> ints;
-	while (std::cin)
+	where_clause where;
+
+	// reads the terms after WHERE, column op value joined by AND and OR on the same line; prints the
+	// error and returns false for a column t doesn't have or an unknown op, after which DELETE skips
+	// the rest of the line and PRINT, as it always has, doesn't
+	auto read_where = [&in](const table &t, std::string_view command, const std::string &tablename, bool skip_bad_op, where_clause &where)
+	{
+		where.assign(1, {});
+		for (;;)
+		{
+			where_term term;
+			term.column = in.token();
+			if (!t.contains_column(term.column))
+			{
+				std::cout << "Error during " << command << ": " << term.column << " does not name a column in " << tablename << '\n';
+				in.ignore_line();
+				return false;
+			}
+
+			char op = in.character(); // TODO: error checking
+			term.value = in.token();
+			switch (op)
+			{
+			case '>':
+				term.comp = compare_t::greater;
+				break;
+			case '<':
+				term.comp = compare_t::less;
+				break;
+			case '=':
+				term.comp = compare_t::equals;
+				break;
+			default:
+				std::cout << "Invalid print command\n";
+				if (skip_bad_op)
+					in.ignore_line();
+				return false;
+			}
+			where.back().push_back(std::move(term));
+
+			if (in.accept("OR"))
+				where.emplace_back();
+			else if (!in.accept("AND"))
+				return true;
+		}
+	};
+	// std::cin used to flush std::cout before every read, keep that output if a bad value aborts the
+	// run, with the commands it acknowledges made durable first
+	static write_ahead_log *abort_wal = wal ? &*wal : nullptr;
+	static std::terminate_handler default_terminate = std::set_terminate([]
+	{
+		try
+		{
+			if (abort_wal)
+				abort_wal->commit();
+		}
+		catch (const std::runtime_error &)
+		{
+		}
+		std::cout.flush();
+		default_terminate();
+	});
+
+	while (in)
 	{
+		if (stats)
+			stats->finish();
 
 		std::cout << "% ";
-		std::cin >> cmd;
+		std::string_view cmd = in.token();
+		if (!in)
+			break;
+
+		if (stats && cmd[0] != '#' && cmd != "QUIT")
+			stats->start(cmd);
+
+		// EXPLAIN PRINT, DELETE or JOIN parses the command as usual, then prints how it would run
+		bool explain = cmd == "EXPLAIN";
+		if (explain)
+		{
+			cmd = in.token();
+			if (cmd != "PRINT" && cmd != "DELETE" && cmd != "JOIN")
+			{
+				std::cout << "Error during EXPLAIN: only PRINT, DELETE and JOIN can be explained\n";
+				in.ignore_line();
+				continue;
+			}
+		}
 
 		if (cmd[0] == '#')
 		{
-			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+			in.ignore_line();
 			continue;
 		}
 		else if (cmd == "CREATE")
 		{
-			std::cin >> tablename1;
+			tablename1 = in.token();
 			std::size_t N;
-			std::cin >> N; // TODO: error checking
+			in.read(N); // TODO: error checking
 
 			if (tables.find(tablename1) != tables.end())
 			{
 				std::cout << "Error during CREATE: Cannot create already existing table " << tablename1 << '\n';
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
@@ -749,141 +5815,136 @@ int main(int argc, char *argv[])
 			table &t = tables[tablename1];
 
 			t.reserve_columns(N);
-			ints.resize(N);
+			types.resize(N);
 			for (std::size_t i = 0; i < N; ++i)
 			{
-				std::cin >> tmp;
-				if (tmp == "double")
-					ints[i] = (std::size_t)typenames::doublename;
-				else if (tmp == "string")
-					ints[i] = (std::size_t)typenames::stringname;
-				else if (tmp == "int")
-					ints[i] = (std::size_t)typenames::intname;
-				else if (tmp == "bool")
-					ints[i] = (std::size_t)typenames::boolname;
-				else
+				types[i] = in.token();
+				if (!table::is_column_type(types[i]))
 					throw std::runtime_error("unknown type");
 			}
 
+			strings.resize(N);
 			for (std::size_t i = 0; i < N; ++i)
 			{
-				std::cin >> tmp;
-				std::cout << ' ' << tmp;
-				switch ((typenames)ints[i])
-				{
-				case typenames::intname:
-					t.add_column<int>(tmp);
-					break;
-				case typenames::stringname:
-					t.add_column<std::string>(tmp);
-					break;
-				case typenames::doublename:
-					t.add_column<double>(tmp);
-					break;
-				case typenames::boolname:
-					t.add_column<bool>(tmp);
-					break;
-				}
+				strings[i] = in.token();
+				std::cout << ' ' << strings[i];
+				t.add_typed_column(types[i], strings[i]);
 			}
+			if (wal)
+				wal->log_create(tablename1, types, strings);
 
 			std::cout << " created \n";
 		}
 		else if (cmd == "QUIT")
 		{
 			std::cout << "Thanks for being silly!\n";
+			if (stats)
+			{
+				std::cout.flush();
+				stats->report(std::cerr);
+			}
 			return 0;
 		}
 		else if (cmd == "REMOVE")
 		{
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tables.erase(tmp) == 0)
 			{
 				std::cout << "Error during REMOVE: " << tmp << " does not name a table in the database\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 			}
 			else
+			{
+				if (wal)
+					wal->log_remove(tmp);
 				std::cout << "Table " << tmp << " removed\n";
+			}
 		}
 		else if (cmd == "INSERT")
 		{
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tmp != "INTO")
 			{
 				std::cout << "Invalid insert command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			std::cin >> tablename1;
+			tablename1 = in.token();
 
 			auto it = tables.find(tablename1);
 			if (it == tables.end())
 			{
 				std::cout << "Error during INSERT: " << tablename1 << " does not name a table in the database\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
 			table &t = it->second;
 
 			std::size_t N;
-			std::cin >> N; // TODO: error checking
+			in.read(N); // TODO: error checking
 
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tmp != "ROWS")
 			{
 				std::cout << "Invalid insert command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			std::size_t K = t.num_rows();
+			std::size_t K = t.num_rows(), first = t.stored_rows();
 
-			for (std::size_t row = 0; row < N; ++row)
+			// a batch of cells at a time, each column parses its own share without per-cell dispatch
+			constexpr std::size_t batch_rows = 1 << 16;
+			static std::vector<std::string_view> cells;
+			t.reserve_rows(first + N);
+			for (std::size_t row = 0; row < N; row += batch_rows)
 			{
-				for (std::size_t col = 0; col < t.num_cols(); ++col)
-				{
-					std::cin >> tmp;
-					t.add_value(col, tmp);
-				}
+				std::size_t rows = std::min(batch_rows, N - row);
+				in.tokens(rows * t.num_cols(), cells);
+				t.append_rows(cells.data(), rows);
+				if (wal)
+					wal->log_insert(tablename1, N, row, rows, t.num_cols(), cells.data());
 			}
+			t.finish_insert(first);
 
 			std::cout << "Added " << N << " rows to " << tablename1 << " from position " << K << " to " << K + N - 1 << '\n';
 		}
 		else if (cmd == "PRINT")
 		{
-			std::cin >> tmp;
+			tmp = in.token();
 
 			if (tmp != "FROM")
 			{
 				std::cout << "Invalid print command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			std::cin >> tablename1; // tablename1
+			tablename1 = in.token(); // tablename1
 			auto it = tables.find(tablename1);
 			if (it == tables.end())
 			{
 				std::cout << "Error during PRINT: " << tablename1 << " does not name a table in the database\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
 			table &t = it->second;
 
 			std::size_t N;
-			std::cin >> N; // TODO: error checking
+			in.read(N); // TODO: error checking
 
 			strings.resize(N);
 			std::size_t i = 0;
 			for (; i < N; ++i)
 			{
-				std::cin >> strings[i];
+				strings[i] = in.token();
 				if (!t.contains_column(strings[i]))
 				{
 					std::cout << "Error during PRINT: " << strings[i] << " does not name a column in " << tablename1 << '\n';
-					std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+					in.ignore_line();
 					break;
 				}
 			}
@@ -893,113 +5954,118 @@ int main(int argc, char *argv[])
 
 			std::size_t M;
 
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tmp == "ALL")
 			{
+				if (explain)
+				{
+					std::cout << "Plan for PRINT from " << tablename1 << ": "
+							  << (options.isQuiet() ? "the row count, no rows read\n" : "every live row in row order\n");
+					continue;
+				}
 				if (!options.isQuiet())
-					t.print(strings);
+					t.print(strings, pool);
 				
 				M = t.num_rows();
 			}
 			else if (tmp != "WHERE")
 			{
 				std::cout << "Invalid print command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 			else
 			{
-				std::cin >> tmp; // colname
-				if (!t.contains_column(tmp))
-				{
-					std::cout << "Error during PRINT: " << tmp << " does not name a column in " << tablename1 << '\n';
-					std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				if (!read_where(t, "PRINT", tablename1, false, where))
 					continue;
-				}
 
-				char op;
-				std::cin >> op; // TODO: error checking
-
-				std::cin >> tmp2; // value
-				switch (op)
+				if (explain)
 				{
-				case '>':
-					M = t.print(strings, tmp, compare_t::greater, tmp2, options.isQuiet());
-					break;
-				case '<':
-					M = t.print(strings, tmp, compare_t::less, tmp2, options.isQuiet());
-					break;
-				case '=':
-					M = t.print(strings, tmp, compare_t::equals, tmp2, options.isQuiet());
-					break;
-				default:
-					std::cout << "Invalid print command\n";
+					std::cout << "Plan for PRINT from " << tablename1 << ": " << t.explain_lookup(where, options.isQuiet(), pool) << '\n';
 					continue;
 				}
+				if (!cache)
+					M = t.print(strings, where, options.isQuiet(), pool);
+				else
+				{
+					// the command's tokens joined by spaces, which no token contains
+					cache_key = "PRINT " + tablename1 + ' ' + std::to_string(strings.size());
+					for (const auto &col : strings)
+						cache_key += ' ' + col;
+					cache_key += " WHERE";
+					for (std::size_t g = 0; g < where.size(); ++g)
+						for (std::size_t j = 0; j < where[g].size(); ++j)
+						{
+							const auto &term = where[g][j];
+							cache_key += j ? " AND " : g ? " OR " : " ";
+							cache_key += term.column;
+							cache_key += ' ';
+							cache_key += "<=>"[static_cast<int>(term.comp) + 1];
+							cache_key += ' ';
+							cache_key += term.value;
+						}
+
+					if (auto hit = cache->find(cache_key, t.version(), 0))
+					{
+						if (!options.isQuiet())
+							t.print_rows(strings, hit->rows, pool);
+						M = hit->count;
+					}
+					else
+					{
+						keep = {cache->max_ids(), {}, true};
+						M = t.print(strings, where, options.isQuiet(), pool, &keep);
+						if (keep.complete)
+							cache->insert(cache_key, t.version(), 0, M, std::move(keep.ids));
+					}
+				}
 			}
 
 			std::cout << "Printed " << M << " matching rows from " << tablename1 << '\n';
 		}
 		else if (cmd == "DELETE")
 		{
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tmp != "FROM")
 			{
 				std::cout << "Invalid DELETE command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			std::cin >> tablename1;
+			tablename1 = in.token();
 			auto it = tables.find(tablename1);
 			if (it == tables.end())
 			{
 				std::cout << "Error during DELETE: " << tablename1 << " does not name a table in the database\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
 			table &t = it->second;
 
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tmp != "WHERE")
 			{
 				std::cout << "Invalid DELETE command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			std::cin >> tmp; // colname
-			if (!t.contains_column(tmp))
-			{
-				std::cout << "Error during DELETE: " << tmp << " does not name a column in " << tablename1 << '\n';
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+			if (!read_where(t, "DELETE", tablename1, true, where))
 				continue;
-			}
 
-			char op;
-			std::cin >> op; // TODO: error checking
-
-			std::cin >> tmp2; // value
-
-			std::size_t N;
-			switch (op)
+			if (explain)
 			{
-			case '>':
-				N = t.delete_rows(tmp, compare_t::greater, tmp2);
-				break;
-			case '<':
-				N = t.delete_rows(tmp, compare_t::less, tmp2);
-				break;
-			case '=':
-				N = t.delete_rows(tmp, compare_t::equals, tmp2);
-				break;
-			default:
-				std::cout << "Invalid print command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				std::cout << "Plan for DELETE from " << tablename1 << ": " << t.explain_lookup(where, false, pool)
+						  << ", then " << t.explain_delete(options.compactAt()) << '\n';
 				continue;
 			}
 
+			std::size_t N = t.delete_rows(where, pool, options.compactAt());
+			if (wal)
+				wal->log_delete(tablename1, where);
+
 			std::cout << "Deleted " << N << " rows from " << tablename1 << '\n';
 		}
 		else if (cmd == "JOIN")
@@ -1007,80 +6073,79 @@ int main(int argc, char *argv[])
 			static std::vector<std::pair<std::string, int>> print_columns;
 			print_columns.clear();
 
-			std::cin >> tablename1;
+			tablename1 = in.token();
 			auto it = tables.find(tablename1);
 			if (it == tables.end())
 			{
 				std::cout << "Error during JOIN: " << tablename1 << " does not name a table in the database\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 			table &t1 = it->second;
 
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tmp != "AND")
 			{
 				std::cout << "Invalid JOIN command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			std::cin >> tablename2;
+			tablename2 = in.token();
 			it = tables.find(tablename2);
 			if (it == tables.end())
 			{
 				std::cout << "Error during JOIN: " << tablename2 << " does not name a table in the database\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 			table &t2 = it->second;
 
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tmp != "WHERE")
 			{
 				std::cout << "Invalid JOIN command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
 			std::string colname1;
-			std::cin >> colname1;
+			colname1 = in.token();
 			if (!t1.contains_column(colname1))
 			{
 				std::cout << "Error during JOIN: " << colname1 << " does not name a column in " << tablename1 << '\n';
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			char tmp_char;
-			std::cin >> tmp_char;
+			in.character(); // '='
 
 			std::string colname2;
-			std::cin >> colname2;
+			colname2 = in.token();
 			if (!t2.contains_column(colname2))
 			{
 				std::cout << "Error during JOIN: " << colname2 << " does not name a column in " << tablename2 << '\n';
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tmp != "AND")
 			{
 				std::cout << "Invalid JOIN command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tmp != "PRINT")
 			{
 				std::cout << "Invalid JOIN command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
 			std::size_t N;
-			std::cin >> N;
+			in.read(N);
 
 			strings.resize(N);
 			ints.resize(N);
@@ -1088,8 +6153,8 @@ int main(int argc, char *argv[])
 			std::size_t i = 0;
 			for (; i < N; ++i)
 			{
-				std::cin >> strings[i];
-				std::cin >> ints[i];
+				strings[i] = in.token();
+				in.read(ints[i]);
 
 				if (ints[i] == 1)
 				{
@@ -1116,71 +6181,226 @@ int main(int argc, char *argv[])
 
 			if (i != N)
 			{
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
+				continue;
+			}
+
+			if (explain)
+			{
+				std::cout << "Plan for JOIN of " << tablename1 << " and " << tablename2 << ": "
+						  << table::explain_join(t1, t2, tablename1, tablename2, colname1, colname2, options.isQuiet()) << '\n';
 				continue;
 			}
 
-			N = table::join(t1, t2, colname1, colname2, strings, ints, options.isQuiet());
+			if (!cache)
+				N = table::join(t1, t2, colname1, colname2, strings, ints, options.isQuiet(), pool);
+			else
+			{
+				cache_key = "JOIN " + tablename1 + ' ' + tablename2 + ' ' + colname1 + ' ' + colname2 + ' ' + std::to_string(strings.size());
+				for (std::size_t j = 0; j < strings.size(); ++j)
+					cache_key += ' ' + strings[j] + ' ' + std::to_string(ints[j]);
+
+				if (auto hit = cache->find(cache_key, t1.version(), t2.version()))
+				{
+					if (!options.isQuiet())
+						table::print_pairs(t1, t2, strings, ints, hit->rows);
+					N = hit->count;
+				}
+				else
+				{
+					keep = {cache->max_ids(), {}, true};
+					N = table::join(t1, t2, colname1, colname2, strings, ints, options.isQuiet(), pool, &keep);
+					if (keep.complete)
+						cache->insert(cache_key, t1.version(), t2.version(), N, std::move(keep.ids));
+				}
+			}
 
 			std::cout << "Printed " << N << " rows from joining " << tablename1 << " to " << tablename2 << '\n';
 		}
 		else if (cmd == "GENERATE")
 		{
-			std::cin >> tmp;
+			tmp = in.token();
 			if (tmp != "FOR")
 			{
 				std::cout << "Invalid GENERATE command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			std::cin >> tablename1;
+			tablename1 = in.token();
 			auto it = tables.find(tablename1);
 			if (it == tables.end())
 			{
 				std::cout << "Error during GENERATE: " << tablename1 << " does not name a table in the database\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
 			table &t = it->second;
 
-			std::cin >> tmp; // indextype
+			tmp = in.token(); // indextype
 
 			index_type type = tmp == "bst" ? index_type::bst : index_type::hash;
 
-			std::cin >> tmp2;
+			tmp2 = in.token();
 			if (tmp2 != "INDEX")
 			{
 				std::cout << "Invalid GENERATE command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			std::cin >> tmp2;
+			tmp2 = in.token();
 			if (tmp2 != "ON")
 			{
 				std::cout << "Invalid GENERATE command\n";
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
-			std::cin >> tmp2; // colname
+			tmp2 = in.token(); // colname
 			if (!t.contains_column(tmp2))
 			{
 				std::cout << "Error during GENERATE: " << tmp2 << " does not name a column in " << tablename1 << '\n';
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				in.ignore_line();
 				continue;
 			}
 
 			std::size_t N = t.generate_index(type, tmp2);
+			if (wal)
+				wal->log_generate(tablename1, type, tmp2);
 
 			std::cout << "Created " << tmp << " index for table " << tablename1 << " on column " << tmp2 << ", with " << N << " distinct keys\n";
 		}
+		else if (cmd == "SAVE")
+		{
+			tablename1 = in.token();
+			tmp = in.token(); // file
+			auto it = tables.find(tablename1);
+			if (it == tables.end())
+			{
+				std::cout << "Error during SAVE: " << tablename1 << " does not name a table in the database\n";
+				in.ignore_line();
+				continue;
+			}
+
+			try
+			{
+				it->second.save(tablename1, tmp);
+			}
+			catch (const std::runtime_error &e)
+			{
+				std::cout << "Error during SAVE: " << e.what() << '\n';
+				continue;
+			}
+
+			std::cout << "Saved " << it->second.num_rows() << " rows of " << tablename1 << " to " << tmp << '\n';
+		}
+		else if (cmd == "LOAD")
+		{
+			tmp = in.token(); // file
+			// with a log the table comes from the log's own copy of the file, which replay reads again
+			std::string copy;
+			try
+			{
+				snapshot_reader snap(tmp);
+				tablename1 = snap.get_string();
+				if (tables.find(tablename1) != tables.end())
+				{
+					std::cout << "Error during LOAD: Cannot load already existing table " << tablename1 << '\n';
+					continue;
+				}
+
+				std::optional<snapshot_reader> copied;
+				if (wal)
+				{
+					copy = wal->adopt_snapshot(tmp);
+					copied.emplace(copy);
+					if (copied->get_string() != tablename1)
+						throw std::runtime_error(tmp + " changed while it was loaded");
+				}
+
+				table &t = tables[tablename1];
+				try
+				{
+					t.load(copied ? *copied : snap);
+				}
+				catch (const std::runtime_error &)
+				{
+					tables.erase(tablename1);
+					throw;
+				}
+
+				if (wal)
+				{
+					// once logged the copy is the log's to delete, even if committing fails
+					std::string logged;
+					logged.swap(copy);
+					wal->log_load(logged);
+				}
+				std::cout << "Loaded " << t.num_rows() << " rows into new table " << tablename1 << " from " << tmp << '\n';
+			}
+			catch (const std::runtime_error &e)
+			{
+				if (!copy.empty())
+					std::remove(copy.c_str());
+				std::cout << "Error during LOAD: " << e.what() << '\n';
+			}
+		}
+		else if (cmd == "CHECKPOINT")
+		{
+			if (!wal)
+			{
+				std::cout << "Error during CHECKPOINT: no write-ahead log, run with --wal\n";
+				continue;
+			}
+
+			std::size_t N;
+			try
+			{
+				N = wal->checkpoint(tables);
+			}
+			catch (const std::runtime_error &e)
+			{
+				std::cout << "Error during CHECKPOINT: " << e.what() << '\n';
+				continue;
+			}
+			std::cout << "Checkpointed " << N << " table(s) to " << options.walPath() << '\n';
+		}
+		else if (cmd == "SHOW")
+		{
+			tmp = in.token();
+			tmp2 = in.token();
+			if (tmp != "INDEXES" || tmp2 != "FOR")
+			{
+				std::cout << "Invalid SHOW command\n";
+				in.ignore_line();
+				continue;
+			}
+
+			tablename1 = in.token();
+			auto it = tables.find(tablename1);
+			if (it == tables.end())
+			{
+				std::cout << "Error during SHOW: " << tablename1 << " does not name a table in the database\n";
+				in.ignore_line();
+				continue;
+			}
+
+			std::size_t bytes = it->second.print_indexes();
+
+			std::cout << "Table " << tablename1 << " has " << it->second.num_indexes() << " index(es) using " << bytes << " bytes\n";
+		}
 		else
 		{
 			std::cout << "Error: unrecognized command\n";
-			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+			in.ignore_line();
 		}
 	}
+
+	if (stats)
+	{
+		std::cout.flush();
+		stats->report(std::cerr);
+	}
 }
\ No newline at end of file
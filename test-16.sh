@@ -0,0 +1,19 @@
+#!/bin/sh
+# Recovery of a LOAD whose snapshot changes afterwards: runs test-16.txt with a new write-ahead log,
+# which loads a snapshot and then overwrites it, deletes the snapshot and restarts on the same log.
+# The table has to come back as it was, rows 1, 2 and 3 once each.
+#
+# usage: ./test-16.sh [silly binary]    (run from the repo root after make release)
+
+SILLY=$(cd "$(dirname "${1:-./silly}")" && pwd)/$(basename "${1:-./silly}")
+SCRIPT=$(pwd)/test-16.txt
+TMP=${TMPDIR:-/tmp}/test-16.$$
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+"$SILLY" -q -w test-16.wal < "$SCRIPT" > /dev/null || exit 1
+rm test-16.snapshot
+printf 'PRINT FROM t 1 a ALL\nQUIT\n' | "$SILLY" -w test-16.wal 2> /dev/null > recovered.txt || exit 1
+
+printf '%% a \n1 \n2 \n3 \nPrinted 3 matching rows from t\n%% Thanks for being silly!\n' | diff - recovered.txt